@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Tracepoints for the AYANEO platform driver LED update pipeline.
+ *
+ * A color update can be followed from the sysfs write (ayaneo_led_request)
+ * through the writer thread (ayaneo_led_frame_start/end) down to the EC
+ * accesses and global lock hold times it caused.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ayaneo_platform
+
+#if !defined(_AYANEO_PLATFORM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AYANEO_PLATFORM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ayaneo_led_request,
+        TP_PROTO(u32 color, int gen),
+        TP_ARGS(color, gen),
+        TP_STRUCT__entry(
+                __field(u32, color)
+                __field(int, gen)
+        ),
+        TP_fast_assign(
+                __entry->color = color;
+                __entry->gen = gen;
+        ),
+        TP_printk("color=%06x gen=%d", __entry->color, __entry->gen)
+);
+
+TRACE_EVENT(ayaneo_led_frame_start,
+        TP_PROTO(u32 color, int gen),
+        TP_ARGS(color, gen),
+        TP_STRUCT__entry(
+                __field(u32, color)
+                __field(int, gen)
+        ),
+        TP_fast_assign(
+                __entry->color = color;
+                __entry->gen = gen;
+        ),
+        TP_printk("color=%06x gen=%d", __entry->color, __entry->gen)
+);
+
+TRACE_EVENT(ayaneo_led_frame_end,
+        TP_PROTO(int gen),
+        TP_ARGS(gen),
+        TP_STRUCT__entry(
+                __field(int, gen)
+        ),
+        TP_fast_assign(
+                __entry->gen = gen;
+        ),
+        TP_printk("gen=%d", __entry->gen)
+);
+
+TRACE_EVENT(ayaneo_ec_ram_write,
+        TP_PROTO(u8 index, const u8 *buf, size_t len, bool word_io),
+        TP_ARGS(index, buf, len, word_io),
+        TP_STRUCT__entry(
+                __field(u8, index)
+                __field(bool, word_io)
+                __dynamic_array(u8, data, len)
+        ),
+        TP_fast_assign(
+                __entry->index = index;
+                __entry->word_io = word_io;
+                memcpy(__get_dynamic_array(data), buf, len);
+        ),
+        TP_printk("index=%02x word_io=%d data=%s", __entry->index, __entry->word_io,
+                  __print_hex(__get_dynamic_array(data), __get_dynamic_array_len(data)))
+);
+
+TRACE_EVENT(ayaneo_ec_write,
+        TP_PROTO(u8 addr, u8 val, int ret),
+        TP_ARGS(addr, val, ret),
+        TP_STRUCT__entry(
+                __field(u8, addr)
+                __field(u8, val)
+                __field(int, ret)
+        ),
+        TP_fast_assign(
+                __entry->addr = addr;
+                __entry->val = val;
+                __entry->ret = ret;
+        ),
+        TP_printk("addr=%02x val=%02x ret=%d", __entry->addr, __entry->val, __entry->ret)
+);
+
+TRACE_EVENT(ayaneo_ec_lock_acquire,
+        TP_PROTO(u64 wait_ns, bool locked),
+        TP_ARGS(wait_ns, locked),
+        TP_STRUCT__entry(
+                __field(u64, wait_ns)
+                __field(bool, locked)
+        ),
+        TP_fast_assign(
+                __entry->wait_ns = wait_ns;
+                __entry->locked = locked;
+        ),
+        TP_printk("wait_ns=%llu locked=%d", __entry->wait_ns, __entry->locked)
+);
+
+TRACE_EVENT(ayaneo_ec_lock_release,
+        TP_PROTO(u64 held_ns),
+        TP_ARGS(held_ns),
+        TP_STRUCT__entry(
+                __field(u64, held_ns)
+        ),
+        TP_fast_assign(
+                __entry->held_ns = held_ns;
+        ),
+        TP_printk("held_ns=%llu", __entry->held_ns)
+);
+
+#endif /* _AYANEO_PLATFORM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ayaneo-platform-trace
+#include <trace/define_trace.h>
@@ -13,38 +13,269 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/acpi.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dmi.h>
+#include <linux/freezer.h>
 #include <linux/init.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/led-class-multicolor.h>
 #include <linux/leds.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/pm.h>
 #include <linux/platform_device.h>
 #include <linux/processor.h>
+#include <linux/regmap.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/wait.h>
+
+#define CREATE_TRACE_POINTS
+#include "ayaneo-platform-trace.h"
+
+/* EC transport
+ *  Every access to the EC, the ACPI global lock included, goes through the
+ *  active transport. On hardware that is the real port I/O and ACPI EC. With
+ *  the ec_emulate module parameter it is a software model of the EC instead,
+ *  so the whole LED pipeline can be loaded and profiled on any machine.
+ */
+struct ayaneo_ec_transport {
+        const char *name;
+        acpi_status (*acquire_lock)(u16 timeout, u32 *handle);
+        acpi_status (*release_lock)(u32 handle);
+        void (*port_outb)(u8 value, u16 port);
+        void (*port_outw)(u16 value, u16 port);
+        u8 (*port_inb)(u16 port);
+        int (*ec_read)(u8 addr, u8 *val);
+        int (*ec_write)(u8 addr, u8 val);
+        void (*delay)(unsigned int delay_us);
+};
+
+static void ayaneo_ec_hw_outb(u8 value, u16 port)
+{
+        outb(value, port);
+}
+
+static void ayaneo_ec_hw_outw(u16 value, u16 port)
+{
+        outw(value, port);
+}
+
+static u8 ayaneo_ec_hw_inb(u16 port)
+{
+        return inb(port);
+}
+
+/* The MCU needs time to consume each write, but the CPU does not need to spin
+ * while it does, so sleep on an hrtimer instead. The slack lets the timer
+ * coalesce with other wakeups without noticeably stretching a frame.
+ */
+#define AYANEO_LED_WRITE_DELAY_SLACK_US         250
+
+static void ayaneo_ec_hw_delay(unsigned int delay_us)
+{
+        usleep_range(delay_us, delay_us + AYANEO_LED_WRITE_DELAY_SLACK_US);
+}
 
-/* Handle ACPI lock mechanism */
+static const struct ayaneo_ec_transport ayaneo_ec_hw_transport = {
+        .name = "hardware",
+        .acquire_lock = acpi_acquire_global_lock,
+        .release_lock = acpi_release_global_lock,
+        .port_outb = ayaneo_ec_hw_outb,
+        .port_outw = ayaneo_ec_hw_outw,
+        .port_inb = ayaneo_ec_hw_inb,
+        .ec_read = ec_read,
+        .ec_write = ec_write,
+        .delay = ayaneo_ec_hw_delay,
+};
+
+static const struct ayaneo_ec_transport *ayaneo_ec = &ayaneo_ec_hw_transport;
+
+/* Statistics
+ *  Counters and log2 latency histograms of the LED pipeline, shown in the
+ *  debugfs stats file and cleared through the reset file. They are updated
+ *  from brightness_set and the writer thread without a common lock, so every
+ *  value is an atomic64_t.
+ *
+ *  Histogram bucket n counts values in [2^n, 2^(n+1)) nanoseconds, the last
+ *  bucket everything above.
+ */
+#define AYANEO_STATS_HIST_BUCKETS     32
+
+struct ayaneo_stats_hist {
+        atomic64_t buckets[AYANEO_STATS_HIST_BUCKETS];
+};
+
+static struct {
+        atomic64_t frames_requested;
+        atomic64_t frames_committed;
+        atomic64_t frames_coalesced;
+        atomic64_t ec_writes;
+        atomic64_t ec_write_failures;
+        atomic64_t pending_since_ns;    /* first request the writer has not picked up */
+        atomic64_t resume_callback_ns;  /* last resume callback */
+        atomic64_t resume_restore_ns;   /* last probe or resume callback to LEDs restored */
+        atomic64_t suspend_callback_ns; /* last suspend callback */
+        atomic64_t frames_aborted;
+        struct ayaneo_stats_hist request_latency;
+        struct ayaneo_stats_hist frame_duration;
+        struct ayaneo_stats_hist lock_wait;
+        struct ayaneo_stats_hist delay_wall;  /* wall-clock, delays sleep */
+        struct ayaneo_stats_hist preempt_step;
+} ayaneo_stats;
+
+static void ayaneo_stats_hist_add(struct ayaneo_stats_hist *hist, u64 ns)
+{
+        int bucket = ns ? min(ilog2(ns), AYANEO_STATS_HIST_BUCKETS - 1) : 0;
+
+        atomic64_inc(&hist->buckets[bucket]);
+}
+
+static void ayaneo_stats_hist_reset(struct ayaneo_stats_hist *hist)
+{
+        for (int i = 0; i < AYANEO_STATS_HIST_BUCKETS; i++)
+                atomic64_set(&hist->buckets[i], 0);
+}
+
+/* Handle ACPI lock mechanism
+ *  Every EC access is bracketed by lock_global_acpi_lock and
+ *  unlock_global_acpi_lock. Between ayaneo_ec_batch_begin and
+ *  ayaneo_ec_batch_end the unlock is deferred, so a whole group of EC writes
+ *  shares a single acquisition of the global lock. To avoid starving the
+ *  firmware the lock is handed back once it has been held for longer than
+ *  ec_lock_max_hold_us, and before sleeping between MCU writes.
+ *
+ *  A batch also holds ayaneo_ec_batch_lock, which serialises the writer thread
+ *  against diagnostics reading the EC. All EC access must happen inside a
+ *  batch. Batches nest within the task that owns the outermost one, which is
+ *  what allows the regmap lock to be a batch as well.
+ */
 static u32 ayaneo_mutex;
 
 #define ACPI_LOCK_DELAY_MS        500
 
+static unsigned int ec_lock_max_hold_us = 1000;
+module_param(ec_lock_max_hold_us, uint, 0644);
+MODULE_PARM_DESC(ec_lock_max_hold_us,
+                 "Maximum time in microseconds a batch of EC writes may hold the ACPI global lock");
+
+static struct {
+        u64 acquisitions;
+        u64 timeouts;
+        u64 wait_ns;
+} ayaneo_ec_lock_stats;
+
+static DEFINE_MUTEX(ayaneo_ec_batch_lock);
+static struct task_struct *ayaneo_ec_batch_owner;
+static int ayaneo_ec_batch_depth;
+static bool ayaneo_ec_lock_held;
+static u64 ayaneo_ec_lock_acquired_ns;
+
+/* Last value programmed into the EC ram high address register, or -1 if
+ * unknown. Only valid while the global lock is held, as the firmware may
+ * reprogram the register as soon as it gets the lock back.
+ */
+static int ayaneo_ec_ram_addr_high = -1;
+
+static bool ayaneo_ec_lock_release(void)
+{
+        ayaneo_ec_ram_addr_high = -1;
+
+        if (!ayaneo_ec_lock_held)
+                return true;
+
+        ayaneo_ec_lock_held = false;
+
+        if (trace_ayaneo_ec_lock_release_enabled())
+                trace_ayaneo_ec_lock_release(ktime_get_ns() - ayaneo_ec_lock_acquired_ns);
+
+        return ACPI_SUCCESS(ayaneo_ec->release_lock(ayaneo_mutex));
+}
+
 static bool lock_global_acpi_lock(void)
 {
-        return ACPI_SUCCESS(acpi_acquire_global_lock(ACPI_LOCK_DELAY_MS, &ayaneo_mutex));
+        u64 start;
+        u64 now;
+        bool locked;
+
+        if (ayaneo_ec_lock_held) {
+                now = ktime_get_ns();
+                if (now - ayaneo_ec_lock_acquired_ns <
+                    (u64)ec_lock_max_hold_us * NSEC_PER_USEC)
+                        return true;
+
+                /* Held for too long, give the firmware a chance */
+                ayaneo_ec_lock_release();
+        }
+
+        start = ktime_get_ns();
+        locked = ACPI_SUCCESS(ayaneo_ec->acquire_lock(ACPI_LOCK_DELAY_MS, &ayaneo_mutex));
+        now = ktime_get_ns();
+
+        ayaneo_ec_lock_stats.acquisitions++;
+        ayaneo_ec_lock_stats.wait_ns += now - start;
+        trace_ayaneo_ec_lock_acquire(now - start, locked);
+        ayaneo_stats_hist_add(&ayaneo_stats.lock_wait, now - start);
+
+        if (!locked) {
+                ayaneo_ec_lock_stats.timeouts++;
+                return false;
+        }
+
+        ayaneo_ec_lock_held = true;
+        ayaneo_ec_lock_acquired_ns = now;
+
+        return true;
 }
 
 static bool unlock_global_acpi_lock(void)
 {
-        return ACPI_SUCCESS(acpi_release_global_lock(ayaneo_mutex));
+        if (ayaneo_ec_batch_depth)
+                return true;
+
+        return ayaneo_ec_lock_release();
+}
+
+static void ayaneo_ec_batch_begin(void)
+{
+        if (ayaneo_ec_batch_owner != current) {
+                mutex_lock(&ayaneo_ec_batch_lock);
+                ayaneo_ec_batch_owner = current;
+        }
+
+        ayaneo_ec_batch_depth++;
+}
+
+static void ayaneo_ec_batch_end(void)
+{
+        if (--ayaneo_ec_batch_depth)
+                return;
+
+        ayaneo_ec_lock_release();
+        ayaneo_ec_batch_owner = NULL;
+        mutex_unlock(&ayaneo_ec_batch_lock);
 }
 
 /* Common ec ram port data */
 #define AYANEO_ADDR_PORT         0x4e
 #define AYANEO_DATA_PORT         0x4f
 #define AYANEO_HIGH_BYTE         0xd1
+#define AYANEO_EC_RAM_WINDOW_SIZE 256
+
+/* Indirect EC ram access through the index/data port pair */
+#define AYANEO_EC_INDEX_SELECT   0x2e
+#define AYANEO_EC_INDEX_DATA     0x2f
+#define AYANEO_EC_RAM_ADDR_LOW   0x10
+#define AYANEO_EC_RAM_ADDR_HIGH  0x11
+#define AYANEO_EC_RAM_DATA       0x12
 
 /* RGB LED EC Ram Registers
  * #define AYANEO_LED_MC_L_Q1_R     0xb3
@@ -136,9 +367,8 @@ static bool unlock_global_acpi_lock(void)
 #define AYANEO_LED_GROUP_LEFT_RIGHT   0x03 /* omit for aya flip when implemented */
 #define AYANEO_LED_GROUP_BUTTON       0x04
 
-#define AYANEO_LED_WRITE_DELAY_LEGACY_MS        2
-#define AYANEO_LED_WRITE_DELAY_MS               1
-#define AYANEO_LED_WRITER_DELAY_RANGE_US        10000, 20000
+#define AYANEO_LED_WRITE_DELAY_LEGACY_US        2000
+#define AYANEO_LED_WRITE_DELAY_US               1000
 #define AYANEO_LED_SUSPEND_RESUME_DELAY_MS      100
 
 enum ayaneo_model {
@@ -156,8 +386,55 @@ enum ayaneo_model {
         slide,
 };
 
+static const char * const AYANEO_MODEL_TEXT[] = {
+        [air] = "air",
+        [air_1s] = "air_1s",
+        [air_1s_limited] = "air_1s_limited",
+        [air_plus] = "air_plus",
+        [air_plus_mendo] = "air_plus_mendo",
+        [air_pro] = "air_pro",
+        [ayaneo_2] = "ayaneo_2",
+        [ayaneo_2s] = "ayaneo_2s",
+        [geek] = "geek",
+        [geek_1s] = "geek_1s",
+        [kun] = "kun",
+        [slide] = "slide",
+};
+
 static enum ayaneo_model model;
 
+/* Model capabilities:
+ *  Behaviour that is faster but has to be verified on a model before it is
+ *  used there. Each field is set for a model only once verified on it; a model
+ *  left empty keeps the conservative behaviour that works on every model. The
+ *  module parameter of each field overrides the table, to try a capability on
+ *  a model that does not have it yet.
+ */
+struct ayaneo_model_caps {
+        bool ec_word_io;                /* see ec_word_io */
+        bool ec_ram_autoinc;            /* see ec_ram_autoinc */
+        bool legacy_batch;              /* see legacy_batch */
+        /* EC write timing, 0 for the delays that work on every model */
+        unsigned int latch_us;
+        unsigned int write_cycle_us;
+        unsigned int resume_ms;
+};
+
+static const struct ayaneo_model_caps ayaneo_model_caps[] = {
+        [air] = { },
+        [air_1s] = { },
+        [air_1s_limited] = { },
+        [air_plus] = { },
+        [air_plus_mendo] = { },
+        [air_pro] = { },
+        [ayaneo_2] = { },
+        [ayaneo_2s] = { },
+        [geek] = { },
+        [geek_1s] = { },
+        [kun] = { },
+        [slide] = { },
+};
+
 enum AYANEO_LED_SUSPEND_MODE {
         AYANEO_LED_SUSPEND_MODE_OEM,
         AYANEO_LED_SUSPEND_MODE_KEEP,
@@ -260,694 +537,2952 @@ static const struct dmi_system_id dmi_table[] = {
         {},
 };
 
-static int ec_write_ram(u8 index, u8 val)
+/* Emulated EC
+ *  A software model of both EC interfaces, selected with ec_emulate:
+ *
+ *  - the superIO index/data port pair in front of the 0xd1xx EC ram window,
+ *    including the low/high address registers, so range writes, address
+ *    caching and 16-bit port writes behave as on hardware.
+ *  - the ACPI EC LED mailbox, committing AYANEO_LED_BRIGHTNESS to the
+ *    subpixel selected by AYANEO_LED_PWM_CONTROL and AYANEO_LED_POS when
+ *    AYANEO_LED_MODE_REG switches to write mode, or on every brightness write
+ *    while it stays in write mode.
+ *
+ *  Every port access and EC transaction costs ec_emulate_latency_ns of busy
+ *  waiting, to model the I/O cost of the real interfaces. The MCU delays of
+ *  the driver itself are slept as usual. Like the hardware, the model is only
+ *  accessed from within an EC batch.
+ */
+static bool ec_emulate;
+module_param(ec_emulate, bool, 0444);
+MODULE_PARM_DESC(ec_emulate, "Use a software EC model instead of the hardware");
+
+static unsigned int ec_emulate_latency_ns = 1000;
+module_param(ec_emulate_latency_ns, uint, 0644);
+MODULE_PARM_DESC(ec_emulate_latency_ns,
+                 "Time in nanoseconds each emulated EC access takes");
+
+/* The emulated MCU acknowledges a latch by clearing the close register, and a
+ * legacy write cycle by clearing AYANEO_LED_MODE_REG, this long after the
+ * write. 0 never acknowledges, like firmware that leaves both registers alone.
+ */
+static unsigned int ec_emulate_mcu_us;
+module_param(ec_emulate_mcu_us, uint, 0644);
+MODULE_PARM_DESC(ec_emulate_mcu_us,
+                 "Time in microseconds the emulated MCU takes to acknowledge a write (0 = never)");
+
+/* Without sleeping, MCU delays and access latency are only accounted, which
+ * runs frames as fast as the driver logic allows and reports the time they
+ * would have taken on hardware.
+ */
+static bool ec_emulate_sleep = true;
+module_param(ec_emulate_sleep, bool, 0644);
+MODULE_PARM_DESC(ec_emulate_sleep,
+                 "Wait out emulated EC latency and MCU delays (default true)");
+
+#define AYANEO_EC_EMU_LEGACY_POS      32
+
+/* I/O trace:
+ *  While trace recording is enabled, the model appends every access and every
+ *  MCU delay to a fixed size trace, readable from debugfs. Comparing the trace
+ *  of an operation against a known good one catches changes to the write
+ *  sequence of a model, and the per frame counters catch a frame that got more
+ *  expensive. Once the trace is full further events are only counted.
+ */
+#define AYANEO_EC_EMU_TRACE_SIZE      4096
+
+enum ayaneo_ec_emu_op {
+        AYANEO_EC_EMU_OUTB,
+        AYANEO_EC_EMU_OUTW,
+        AYANEO_EC_EMU_INB,
+        AYANEO_EC_EMU_EC_WRITE,
+        AYANEO_EC_EMU_EC_READ,
+        AYANEO_EC_EMU_DELAY,
+};
+
+static const char * const AYANEO_EC_EMU_OP_TEXT[] = {
+        [AYANEO_EC_EMU_OUTB] = "outb",
+        [AYANEO_EC_EMU_OUTW] = "outw",
+        [AYANEO_EC_EMU_INB] = "inb",
+        [AYANEO_EC_EMU_EC_WRITE] = "ec_write",
+        [AYANEO_EC_EMU_EC_READ] = "ec_read",
+        [AYANEO_EC_EMU_DELAY] = "delay",
+};
+
+struct ayaneo_ec_emu_event {
+        u8 op;
+        u16 addr;
+        u32 value;
+};
+
+static struct {
+        bool enabled;
+        unsigned int len;
+        u64 dropped;
+        struct ayaneo_ec_emu_event events[AYANEO_EC_EMU_TRACE_SIZE];
+} ayaneo_ec_emu_trace;
+
+/* Recording from load on also captures the take-control done after probe */
+module_param_named(ec_emulate_trace, ayaneo_ec_emu_trace.enabled, bool, 0444);
+MODULE_PARM_DESC(ec_emulate_trace, "Record the emulated EC I/O trace from module load on");
+
+static struct {
+        u8 addr;                /* last value written to AYANEO_ADDR_PORT */
+        u8 index;               /* selected superIO index register */
+        u8 ram_addr_low;
+        u8 ram_addr_high;
+        u8 ram[AYANEO_EC_RAM_WINDOW_SIZE];
+        u8 ec[256];
+        u8 legacy_leds[AYANEO_LED_GROUP_BUTTON + 1][AYANEO_EC_EMU_LEGACY_POS];
+        u64 port_writes;
+        u64 port_reads;
+        u64 ec_writes;
+        u64 ec_reads;
+        u64 latches;
+        u64 legacy_commits;
+        u64 latch_ns[2];        /* when CLOSE_1 and CLOSE_2 were last set */
+        u64 write_cycle_ns;     /* when the last legacy write cycle started */
+        u64 delay_us;
+        u64 busy_ns;
+        u64 frames;
+        u64 frame_start_writes;
+        u64 frame_start_delay_us;
+        u64 frame_writes;
+        u64 frame_delay_us;
+        u64 frame_max_writes;
+        u64 frame_max_delay_us;
+} ayaneo_ec_emu;
+
+static void ayaneo_ec_emu_record(enum ayaneo_ec_emu_op op, u16 addr, u32 value)
 {
-        int ret;
+        struct ayaneo_ec_emu_event *event;
 
-        if (!lock_global_acpi_lock())
-                return -EBUSY;
+        if (!ayaneo_ec_emu_trace.enabled)
+                return;
 
-	outb(0x2e, AYANEO_ADDR_PORT);
-        outb(0x11, AYANEO_DATA_PORT);
-        outb(0x2f, AYANEO_ADDR_PORT);
-        outb(AYANEO_HIGH_BYTE, AYANEO_DATA_PORT);
-        outb(0x2e, AYANEO_ADDR_PORT);
-        outb(0x10, AYANEO_DATA_PORT);
-        outb(0x2f, AYANEO_ADDR_PORT);
-        outb(index, AYANEO_DATA_PORT);
-        outb(0x2e, AYANEO_ADDR_PORT);
-        outb(0x12, AYANEO_DATA_PORT);
-        outb(0x2f, AYANEO_ADDR_PORT);
-        outb(val, AYANEO_DATA_PORT);
+        if (ayaneo_ec_emu_trace.len == AYANEO_EC_EMU_TRACE_SIZE) {
+                ayaneo_ec_emu_trace.dropped++;
+                return;
+        }
 
-        if (!unlock_global_acpi_lock())
-                return -EBUSY;
+        event = &ayaneo_ec_emu_trace.events[ayaneo_ec_emu_trace.len++];
+        event->op = op;
+        event->addr = addr;
+        event->value = value;
+}
 
-        return ret;
+static void ayaneo_ec_emu_access(void)
+{
+        ayaneo_ec_emu.busy_ns += ec_emulate_latency_ns;
+
+        if (ec_emulate_sleep && ec_emulate_latency_ns)
+                ndelay(ec_emulate_latency_ns);
 }
 
-/* Function Summary
- * AYANEO devices can be largely divided into 2 groups; modern and legacy.
- *   - Legacy devices use a microcontroller either embedded into or controlled via
- *     the system's ACPI controller.
- *   - Modern devices use a dedicated microcontroller and communicate via shared
- *     memory.
- *
- * The control scheme is largely shared between both device types and many of
- * the command values are shared.
- *
- * ayaneo_led_mc_set / ayaneo_led_mc_legacy_set
- *       Sets the value of a single address or subpixel
- *
- * ayaneo_led_mc_release / ayaneo_led_mc_legacy_release
- *       Releases control of the LEDs back to the microcontroller.
- *       This function is abstracted by ayaneo_led_mc_release_control.
- *
- * ayaneo_led_mc_hold / ayaneo_led_mc_legacy_hold
- *       Takes and holds control of the LEDs from the microcontroller.
- *       This function is abstracted by ayaneo_led_mc_take_control.
- *
- * ayaneo_led_mc_intensity / ayaneo_led_mc_legacy_intensity
- *       Sets the values of all of the LEDs in the zones of a given group.
- *
- * ayaneo_led_mc_off / ayaneo_led_mc_legacy_off
- *       Instructs the microcontroller to disable output for the given group.
- *
- * ayaneo_led_mc_on / ayaneo_led_mc_legacy_on
- *       Instructs the microcontroller to enable output for the given group.
- *
- * ayaneo_led_mc_reset / ayaneo_led_mc_legacy_reset
- *       Reverts all of the microcontroller internal registers to power on
- *       defaults.
- */
+static void ayaneo_ec_emu_delay(unsigned int delay_us)
+{
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_DELAY, 0, delay_us);
+        ayaneo_ec_emu.delay_us += delay_us;
 
-/* Dedicated microcontroller methods */
-static void ayaneo_led_mc_set(u8 group, u8 pos, u8 brightness)
+        if (ec_emulate_sleep)
+                ayaneo_ec_hw_delay(delay_us);
+}
+
+static u64 ayaneo_ec_emu_writes(void)
 {
-        u8 led_offset;
-        u8 close_cmd;
+        return ayaneo_ec_emu.port_writes + ayaneo_ec_emu.ec_writes;
+}
 
-        if (group < 2)
-        {
-                led_offset = AYANEO_LED_MC_ADDR_L;
-                close_cmd = AYANEO_LED_MC_ADDR_CLOSE_2;
-        }
-        else
-        {
-                led_offset = AYANEO_LED_MC_ADDR_R;
-                close_cmd = AYANEO_LED_MC_ADDR_CLOSE_1;
-        }
+/* Accounts the EC writes and MCU delay of one frame */
+static void ayaneo_ec_emu_frame_begin(void)
+{
+        if (!ec_emulate)
+                return;
 
-        ec_write_ram(led_offset + pos, brightness);
-        ec_write_ram(close_cmd, 0x01);
-        mdelay(AYANEO_LED_WRITE_DELAY_MS);
+        ayaneo_ec_emu.frame_start_writes = ayaneo_ec_emu_writes();
+        ayaneo_ec_emu.frame_start_delay_us = ayaneo_ec_emu.delay_us;
 }
 
-static void ayaneo_led_mc_release(void)
+static void ayaneo_ec_emu_frame_end(void)
 {
-        ec_write_ram(AYANEO_LED_MC_MODE_ADDR, AYANEO_LED_MC_MODE_RELEASE);
+        if (!ec_emulate)
+                return;
+
+        ayaneo_ec_emu.frames++;
+        ayaneo_ec_emu.frame_writes = ayaneo_ec_emu_writes() - ayaneo_ec_emu.frame_start_writes;
+        ayaneo_ec_emu.frame_delay_us = ayaneo_ec_emu.delay_us - ayaneo_ec_emu.frame_start_delay_us;
+        ayaneo_ec_emu.frame_max_writes = max(ayaneo_ec_emu.frame_max_writes,
+                                             ayaneo_ec_emu.frame_writes);
+        ayaneo_ec_emu.frame_max_delay_us = max(ayaneo_ec_emu.frame_max_delay_us,
+                                               ayaneo_ec_emu.frame_delay_us);
 }
 
-static void ayaneo_led_mc_hold(void)
+static acpi_status ayaneo_ec_emu_acquire_lock(u16 timeout, u32 *handle)
 {
-        ec_write_ram(AYANEO_LED_MC_MODE_ADDR, AYANEO_LED_MC_MODE_HOLD);
+        *handle = 0;
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        return AE_OK;
 }
 
-static void ayaneo_led_mc_intensity(u8 group, u8 *color, u8 zones[])
+static acpi_status ayaneo_ec_emu_release_lock(u32 handle)
 {
-        int zone;
+        return AE_OK;
+}
 
-        for (zone = 0; zone < 4; zone++) {
-                ayaneo_led_mc_set(group, zones[zone], color[0]);
-                ayaneo_led_mc_set(group, zones[zone] + 1, color[1]);
-                ayaneo_led_mc_set(group, zones[zone] + 2, color[2]);
+static u8 *ayaneo_ec_emu_index_reg(u8 index)
+{
+        switch (index) {
+                case AYANEO_EC_RAM_ADDR_LOW:
+                        return &ayaneo_ec_emu.ram_addr_low;
+                case AYANEO_EC_RAM_ADDR_HIGH:
+                        return &ayaneo_ec_emu.ram_addr_high;
+                default:
+                        return NULL;
         }
-
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
 }
 
-static void ayaneo_led_mc_off(void)
+static void ayaneo_ec_emu_ram_write(u8 value)
 {
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+        u8 addr = ayaneo_ec_emu.ram_addr_low;
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        if (ayaneo_ec_emu.ram_addr_high != AYANEO_HIGH_BYTE)
+                return;
+
+        ayaneo_ec_emu.ram[addr] = value;
+
+        if ((addr == AYANEO_LED_MC_ADDR_CLOSE_1 || addr == AYANEO_LED_MC_ADDR_CLOSE_2) &&
+            value == 0x01) {
+                ayaneo_ec_emu.latches++;
+                ayaneo_ec_emu.latch_ns[addr == AYANEO_LED_MC_ADDR_CLOSE_2] = ktime_get_ns();
+        }
 }
 
-static void ayaneo_led_mc_on(void)
+static bool ayaneo_ec_emu_mcu_done(u64 since_ns)
 {
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
+        return ec_emulate_mcu_us &&
+               ktime_get_ns() - since_ns >= (u64)ec_emulate_mcu_us * NSEC_PER_USEC;
+}
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_PATTERN_ADDR, AYANEO_LED_CMD_PATTERN_OFF);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_PATTERN_ADDR, AYANEO_LED_CMD_PATTERN_OFF);
+static u8 ayaneo_ec_emu_ram_read(void)
+{
+        u8 addr = ayaneo_ec_emu.ram_addr_low;
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_FADE_ADDR, AYANEO_LED_CMD_FADE_OFF);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_FADE_ADDR, AYANEO_LED_CMD_FADE_OFF);
+        if (ayaneo_ec_emu.ram_addr_high != AYANEO_HIGH_BYTE)
+                return 0xff;
 
-        /* Set static color animation */
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ANIM_1_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ANIM_1_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ANIM_2_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ANIM_2_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ANIM_3_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ANIM_3_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ANIM_4_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ANIM_4_ADDR, AYANEO_LED_CMD_ANIM_STATIC);
+        if ((addr == AYANEO_LED_MC_ADDR_CLOSE_1 || addr == AYANEO_LED_MC_ADDR_CLOSE_2) &&
+            ayaneo_ec_emu_mcu_done(ayaneo_ec_emu.latch_ns[addr == AYANEO_LED_MC_ADDR_CLOSE_2]))
+                ayaneo_ec_emu.ram[addr] = 0x00;
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_WATCHDOG_ADDR, AYANEO_LED_CMD_WATCHDOG_ON);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_WATCHDOG_ADDR, AYANEO_LED_CMD_WATCHDOG_ON);
+        return ayaneo_ec_emu.ram[addr];
+}
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+static void ayaneo_ec_emu_port_write(u8 value, u16 port)
+{
+        u8 *reg;
+
+        if (port == AYANEO_ADDR_PORT) {
+                ayaneo_ec_emu.addr = value;
+                return;
+        }
+
+        if (port != AYANEO_DATA_PORT)
+                return;
+
+        switch (ayaneo_ec_emu.addr) {
+                case AYANEO_EC_INDEX_SELECT:
+                        ayaneo_ec_emu.index = value;
+                        break;
+                case AYANEO_EC_INDEX_DATA:
+                        if (ayaneo_ec_emu.index == AYANEO_EC_RAM_DATA) {
+                                ayaneo_ec_emu_ram_write(value);
+                                break;
+                        }
+
+                        reg = ayaneo_ec_emu_index_reg(ayaneo_ec_emu.index);
+                        if (reg)
+                                *reg = value;
+                        break;
+                default:
+                        break;
+        }
 }
 
-static void ayaneo_led_mc_reset(void)
+static void ayaneo_ec_emu_outb(u8 value, u16 port)
 {
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+        ayaneo_ec_emu_access();
+        ayaneo_ec_emu.port_writes++;
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_OUTB, port, value);
 
-        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        ayaneo_ec_emu_port_write(value, port);
 }
 
-/* ACPI controller methods */
-static void ayaneo_led_mc_legacy_set(u8 group, u8 pos, u8 brightness)
+/* A word written to a port puts its high byte on the next port, in a single
+ * bus cycle.
+ */
+static void ayaneo_ec_emu_outw(u16 value, u16 port)
 {
-        if (!lock_global_acpi_lock())
-                return;
+        ayaneo_ec_emu_access();
+        ayaneo_ec_emu.port_writes++;
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_OUTW, port, value);
 
-        ec_write(AYANEO_LED_PWM_CONTROL, group);
-        ec_write(AYANEO_LED_POS, pos);
-        ec_write(AYANEO_LED_BRIGHTNESS, brightness);
-        ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_WRITE);
+        ayaneo_ec_emu_port_write(value & 0xff, port);
+        ayaneo_ec_emu_port_write(value >> 8, port + 1);
+}
 
-        if (!unlock_global_acpi_lock())
-                return;
+static u8 ayaneo_ec_emu_port_read(u16 port)
+{
+        u8 *reg;
 
-        mdelay(AYANEO_LED_WRITE_DELAY_LEGACY_MS);
+        if (port == AYANEO_ADDR_PORT)
+                return ayaneo_ec_emu.addr;
 
-        if (!lock_global_acpi_lock())
-                return;
+        if (port != AYANEO_DATA_PORT)
+                return 0xff;
 
-        ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+        switch (ayaneo_ec_emu.addr) {
+                case AYANEO_EC_INDEX_SELECT:
+                        return ayaneo_ec_emu.index;
+                case AYANEO_EC_INDEX_DATA:
+                        if (ayaneo_ec_emu.index == AYANEO_EC_RAM_DATA)
+                                return ayaneo_ec_emu_ram_read();
 
-        if (!unlock_global_acpi_lock())
-                return;
+                        reg = ayaneo_ec_emu_index_reg(ayaneo_ec_emu.index);
+                        return reg ? *reg : 0xff;
+                default:
+                        return 0xff;
+        }
 }
 
-static void ayaneo_led_mc_legacy_release(void)
+static u8 ayaneo_ec_emu_inb(u16 port)
 {
-        if (!lock_global_acpi_lock())
-                return;
+        u8 value;
 
-        ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_RELEASE);
+        ayaneo_ec_emu_access();
+        ayaneo_ec_emu.port_reads++;
 
-        if (!unlock_global_acpi_lock())
-                return;
+        value = ayaneo_ec_emu_port_read(port);
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_INB, port, value);
+
+        return value;
 }
 
-static void ayaneo_led_mc_legacy_hold(void)
+static void ayaneo_ec_emu_legacy_commit(void)
 {
-        if (!lock_global_acpi_lock())
-                return;
+        u8 group = ayaneo_ec_emu.ec[AYANEO_LED_PWM_CONTROL];
+        u8 pos = ayaneo_ec_emu.ec[AYANEO_LED_POS];
 
-        ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+        ayaneo_ec_emu.legacy_commits++;
 
-        if (!unlock_global_acpi_lock())
+        if (group > AYANEO_LED_GROUP_BUTTON || pos >= AYANEO_EC_EMU_LEGACY_POS)
                 return;
+
+        ayaneo_ec_emu.legacy_leds[group][pos] = ayaneo_ec_emu.ec[AYANEO_LED_BRIGHTNESS];
 }
 
-static void ayaneo_led_mc_legacy_intensity_single(u8 group, u8 *color, u8 zone)
+static int ayaneo_ec_emu_ec_write(u8 addr, u8 val)
 {
-        ayaneo_led_mc_legacy_set(group, zone, color[0]);
-        ayaneo_led_mc_legacy_set(group, zone + 1, color[1]);
-        ayaneo_led_mc_legacy_set(group, zone + 2, color[2]);
+        ayaneo_ec_emu_access();
+        ayaneo_ec_emu.ec_writes++;
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_EC_WRITE, addr, val);
+
+        ayaneo_ec_emu.ec[addr] = val;
+
+        switch (addr) {
+                case AYANEO_LED_MODE_REG:
+                        if (val == AYANEO_LED_MODE_WRITE) {
+                                ayaneo_ec_emu_legacy_commit();
+                                ayaneo_ec_emu.write_cycle_ns = ktime_get_ns();
+                        }
+                        break;
+                case AYANEO_LED_BRIGHTNESS:
+                        if (ayaneo_ec_emu.ec[AYANEO_LED_MODE_REG] == AYANEO_LED_MODE_WRITE)
+                                ayaneo_ec_emu_legacy_commit();
+                        break;
+                default:
+                        break;
+        }
+
+        return 0;
 }
 
-static void ayaneo_led_mc_legacy_intensity(u8 group, u8 *color, u8 zones[])
+static int ayaneo_ec_emu_ec_read(u8 addr, u8 *val)
 {
-        int zone;
+        ayaneo_ec_emu_access();
+        ayaneo_ec_emu.ec_reads++;
 
-        for (zone = 0; zone < 4; zone++) {
-                ayaneo_led_mc_legacy_intensity_single(group, color, zones[zone]);
-        }
+        if (addr == AYANEO_LED_MODE_REG &&
+            ayaneo_ec_emu.ec[addr] == AYANEO_LED_MODE_WRITE &&
+            ayaneo_ec_emu_mcu_done(ayaneo_ec_emu.write_cycle_ns))
+                ayaneo_ec_emu.ec[addr] = 0x00;
 
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        *val = ayaneo_ec_emu.ec[addr];
+        ayaneo_ec_emu_record(AYANEO_EC_EMU_EC_READ, addr, *val);
+
+        return 0;
 }
 
-/* KUN doesn't use consistant zone mapping for RGB, adjust */
-static void ayaneo_led_mc_legacy_intensity_kun(u8 group, u8 *color)
+static const struct ayaneo_ec_transport ayaneo_ec_emu_transport = {
+        .name = "emulated",
+        .acquire_lock = ayaneo_ec_emu_acquire_lock,
+        .release_lock = ayaneo_ec_emu_release_lock,
+        .port_outb = ayaneo_ec_emu_outb,
+        .port_outw = ayaneo_ec_emu_outw,
+        .port_inb = ayaneo_ec_emu_inb,
+        .ec_read = ayaneo_ec_emu_ec_read,
+        .ec_write = ayaneo_ec_emu_ec_write,
+        .delay = ayaneo_ec_emu_delay,
+};
+
+/* 16-bit port I/O:
+ *  AYANEO_ADDR_PORT and AYANEO_DATA_PORT are adjacent, so a single outw() to
+ *  the address port writes both halves of an index/data pair in one bus cycle
+ *  instead of two. This is only used on models whose capabilities have
+ *  ec_word_io set, none so far, or when forced with the ec_word_io module
+ *  parameter. The parameter may be changed at runtime to compare both modes;
+ *  the time spent in port I/O per EC ram write is accounted separately for
+ *  each in ayaneo_ec_ram_stats.
+ */
+static int ec_word_io = -1;
+module_param(ec_word_io, int, 0644);
+MODULE_PARM_DESC(ec_word_io,
+                 "Use 16-bit port writes for EC ram access (-1 = model default, 0 = off, 1 = on)");
+
+enum ayaneo_ec_io_mode {
+        AYANEO_EC_IO_BYTE,
+        AYANEO_EC_IO_WORD,
+        AYANEO_EC_IO_MODES
+};
+
+static struct {
+        u64 writes[AYANEO_EC_IO_MODES];
+        u64 write_ns[AYANEO_EC_IO_MODES];
+} ayaneo_ec_ram_stats;
+
+static bool ayaneo_ec_word_io_supported(void)
 {
-        u8 zone;
-        u8 remap_color[3];
+        if (ec_word_io >= 0)
+                return ec_word_io;
 
-        if (group == AYANEO_LED_GROUP_BUTTON)
-        {
-                zone = 12;
-                remap_color[0] = color[2];
-                remap_color[1] = color[0];
-                remap_color[2] = color[1];
-                ayaneo_led_mc_legacy_intensity_single(AYANEO_LED_GROUP_BUTTON, remap_color, zone);
-                ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        return ayaneo_model_caps[model].ec_word_io;
+}
+
+static void ayaneo_ec_port_write(enum ayaneo_ec_io_mode mode, u8 addr, u8 data)
+{
+        if (mode == AYANEO_EC_IO_WORD) {
+                ayaneo_ec->port_outw(((u16)data << 8) | addr, AYANEO_ADDR_PORT);
                 return;
         }
 
-        zone = 3;
-        remap_color[0] = color[1];
-        remap_color[1] = color[0];
-        remap_color[2] = color[2];
-        ayaneo_led_mc_legacy_intensity_single(group, remap_color, zone);
+        ayaneo_ec->port_outb(addr, AYANEO_ADDR_PORT);
+        ayaneo_ec->port_outb(data, AYANEO_DATA_PORT);
+}
 
-        zone = 6;
-        remap_color[0] = color[1];
-        remap_color[1] = color[2];
-        remap_color[2] = color[0];
-        ayaneo_led_mc_legacy_intensity_single(group, remap_color, zone);
+static void ayaneo_ec_index_write(enum ayaneo_ec_io_mode mode, u8 reg, u8 val)
+{
+        ayaneo_ec_port_write(mode, AYANEO_EC_INDEX_SELECT, reg);
+        ayaneo_ec_port_write(mode, AYANEO_EC_INDEX_DATA, val);
+}
 
-        zone = 9;
-        remap_color[0] = color[2];
-        remap_color[1] = color[0];
-        remap_color[2] = color[1];
-        ayaneo_led_mc_legacy_intensity_single(group, remap_color, zone);
+/* EC ram address auto-increment:
+ *  Some ECs advance the low address register after every access to the data
+ *  register, so a contiguous range only needs its start address programmed
+ *  once. Only models whose capabilities have ec_ram_autoinc set, none so
+ *  far, rely on it; everywhere else every byte gets its own address.
+ */
+static int ec_ram_autoinc = -1;
+module_param(ec_ram_autoinc, int, 0644);
+MODULE_PARM_DESC(ec_ram_autoinc,
+                 "Rely on EC ram address auto-increment for range writes (-1 = model default, 0 = off, 1 = on)");
 
-        zone = 12;
-        remap_color[0] = color[2];
-        remap_color[1] = color[1];
-        remap_color[2] = color[0];
-        ayaneo_led_mc_legacy_intensity_single(group, remap_color, zone);
+static bool ayaneo_ec_ram_autoinc_supported(void)
+{
+        if (ec_ram_autoinc >= 0)
+                return ec_ram_autoinc;
 
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        return ayaneo_model_caps[model].ec_ram_autoinc;
 }
 
-static void ayaneo_led_mc_legacy_off(void)
+/* Writes len bytes from buf to consecutive EC ram addresses starting at index,
+ * under a single acquisition of the global lock.
+ */
+static int ec_write_ram_range(u8 index, const u8 *buf, size_t len)
 {
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+        enum ayaneo_ec_io_mode mode;
+        bool autoinc;
+        u64 start;
 
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        if (!lock_global_acpi_lock()) {
+                atomic64_add(len, &ayaneo_stats.ec_write_failures);
+                return -EBUSY;
+        }
+
+        mode = ayaneo_ec_word_io_supported() ? AYANEO_EC_IO_WORD : AYANEO_EC_IO_BYTE;
+        autoinc = ayaneo_ec_ram_autoinc_supported();
+        trace_ayaneo_ec_ram_write(index, buf, len, mode == AYANEO_EC_IO_WORD);
+        start = ktime_get_ns();
+
+        if (ayaneo_ec_ram_addr_high != AYANEO_HIGH_BYTE) {
+                ayaneo_ec_index_write(mode, AYANEO_EC_RAM_ADDR_HIGH, AYANEO_HIGH_BYTE);
+                ayaneo_ec_ram_addr_high = AYANEO_HIGH_BYTE;
+        }
+
+        for (size_t i = 0; i < len; i++) {
+                if (i == 0 || !autoinc)
+                        ayaneo_ec_index_write(mode, AYANEO_EC_RAM_ADDR_LOW, index + i);
+                ayaneo_ec_index_write(mode, AYANEO_EC_RAM_DATA, buf[i]);
+        }
+
+        ayaneo_ec_ram_stats.write_ns[mode] += ktime_get_ns() - start;
+        ayaneo_ec_ram_stats.writes[mode] += len;
+        atomic64_add(len, &ayaneo_stats.ec_writes);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return 0;
 }
 
-static void ayaneo_led_mc_legacy_on(void)
+static int ec_write_ram(u8 index, u8 val)
 {
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
+        return ec_write_ram_range(index, &val, 1);
+}
 
-        // note: omit for aya flip when implemented, causes unexpected behavior
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+static u8 ayaneo_ec_index_read(enum ayaneo_ec_io_mode mode, u8 reg)
+{
+        ayaneo_ec_port_write(mode, AYANEO_EC_INDEX_SELECT, reg);
+        ayaneo_ec->port_outb(AYANEO_EC_INDEX_DATA, AYANEO_ADDR_PORT);
+
+        return ayaneo_ec->port_inb(AYANEO_DATA_PORT);
 }
 
-static void ayaneo_led_mc_legacy_reset(void)
+/* Reads len bytes from consecutive EC ram addresses starting at index into buf,
+ * under a single acquisition of the global lock.
+ */
+static int ec_read_ram_range(u8 index, u8 *buf, size_t len)
 {
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
-                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+        enum ayaneo_ec_io_mode mode;
+        bool autoinc;
 
-        // note: omit for aya flip when implemented, causes unexpected behavior
-        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        mode = ayaneo_ec_word_io_supported() ? AYANEO_EC_IO_WORD : AYANEO_EC_IO_BYTE;
+        autoinc = ayaneo_ec_ram_autoinc_supported();
+
+        if (ayaneo_ec_ram_addr_high != AYANEO_HIGH_BYTE) {
+                ayaneo_ec_index_write(mode, AYANEO_EC_RAM_ADDR_HIGH, AYANEO_HIGH_BYTE);
+                ayaneo_ec_ram_addr_high = AYANEO_HIGH_BYTE;
+        }
+
+        for (size_t i = 0; i < len; i++) {
+                if (i == 0 || !autoinc)
+                        ayaneo_ec_index_write(mode, AYANEO_EC_RAM_ADDR_LOW, index + i);
+                buf[i] = ayaneo_ec_index_read(mode, AYANEO_EC_RAM_DATA);
+        }
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return 0;
 }
 
-/* Device command abstractions */
-static void ayaneo_led_mc_take_control(void)
+static int ec_read_ram(u8 index, u8 *val)
 {
-        switch (model) {
-                case air:
-                case air_1s:
-                case air_1s_limited:
-                case air_pro:
-                case air_plus_mendo:
-                case geek:
-                case geek_1s:
-                case ayaneo_2:
-                case ayaneo_2s:
-                case kun:
-                        ayaneo_led_mc_legacy_hold();
-                        ayaneo_led_mc_legacy_reset();
-                        ayaneo_led_mc_legacy_off();
-                        break;
-                case air_plus:
-                case slide:
-                        ayaneo_led_mc_hold();
-                        ayaneo_led_mc_reset();
-                        ayaneo_led_mc_off();
-                        break;
-                default:
-                        break;
-                }
+        return ec_read_ram_range(index, val, 1);
 }
 
-static void ayaneo_led_mc_release_control(void)
+/* Only the dedicated microcontroller models expose the LED registers through
+ * the EC ram window.
+ */
+static bool ayaneo_ec_ram_supported(void)
 {
         switch (model) {
-                case air:
-                case air_1s:
-                case air_1s_limited:
-                case air_pro:
-                case air_plus_mendo:
-                case geek:
-                case geek_1s:
-                case ayaneo_2:
-                case ayaneo_2s:
-                case kun:
-                        ayaneo_led_mc_legacy_reset();
-                        ayaneo_led_mc_legacy_release();
-                        break;
                 case air_plus:
                 case slide:
-                        ayaneo_led_mc_reset();
-                        ayaneo_led_mc_release();
-                        break;
+                        return true;
                 default:
-                        break;
-                }
+                        return false;
+        }
 }
 
-/* Threaded writes:
- *  The writer thread's job is to push updates to the physical LEDs as fast as
- *  possible while allowing updates to the LED multi_intensity/brightness sysfs
- *  attributes to return quickly.
- *
- *  During multi_intensity/brightness set, the ayaneo_led_mc_update_color array
- *  is updated with the target color and ayaneo_led_mc_update_required is
- *  incremented by 1.
+/* Captures the whole EC ram window in one acquisition of the global lock, so
+ * the snapshot is consistent with respect to the firmware.
+ */
+static int ayaneo_ec_ram_snapshot(u8 *buf)
+{
+        int ret;
+
+        ayaneo_ec_batch_begin();
+        ret = ec_read_ram_range(0x00, buf, AYANEO_EC_RAM_WINDOW_SIZE);
+        ayaneo_ec_batch_end();
+
+        return ret;
+}
+
+/* EC write timing
+ *  The microcontroller needs time to consume a write before it accepts the
+ *  next one. All pacing of EC writes is declared here and applied by the
+ *  regmap buses below, never by the LED command helpers.
  *
- *  When the writer thread begins its next loop, it copies the current values of
- *  ayaneo_led_mc_update_required, and ayaneo_led_mc_update_color, after which
- *  the new color is pushed to the microcontroller. After the color has been
- *  pushed the writer thread subtracts the starting value from
- *  ayaneo_led_mc_update_required. If any updates were pushed to
- *  ayaneo_led_mc_update_required during the writes then the following iteration
- *  will immediately begin writing the new colors to the microcontroller,
- *  otherwise it'll sleep for a short while.
+ *  Each model starts from the delays in its capabilities, or the ones that
+ *  work on every model where those are not set, which is every model so far.
+ *  They may then be shortened by calibration (see below). Any value set
+ *  through a module parameter wins over both.
+ */
+static int latch_delay_us = -1;
+module_param(latch_delay_us, int, 0444);
+MODULE_PARM_DESC(latch_delay_us,
+                 "Delay in microseconds after a dedicated MCU latch (-1 = model default)");
+
+static int write_cycle_delay_us = -1;
+module_param(write_cycle_delay_us, int, 0444);
+MODULE_PARM_DESC(write_cycle_delay_us,
+                 "Delay in microseconds between WRITE and HOLD of a legacy EC write (-1 = model default)");
+
+static int resume_delay_ms = -1;
+module_param(resume_delay_ms, int, 0444);
+MODULE_PARM_DESC(resume_delay_ms,
+                 "Delay in milliseconds for the MCU to settle on suspend and resume (-1 = model default)");
+
+static struct {
+        unsigned int latch_us;          /* after a dedicated MCU latch */
+        unsigned int write_cycle_us;    /* between WRITE and HOLD of an ACPI controller write cycle */
+        unsigned int resume_ms;         /* for the MCU to settle on suspend and resume */
+        bool calibrated;
+} ayaneo_ec_timing = {
+        .latch_us = AYANEO_LED_WRITE_DELAY_US,
+        .write_cycle_us = AYANEO_LED_WRITE_DELAY_LEGACY_US,
+        .resume_ms = AYANEO_LED_SUSPEND_RESUME_DELAY_MS,
+};
+
+static void ayaneo_ec_timing_defaults(void)
+{
+        const struct ayaneo_model_caps *caps = &ayaneo_model_caps[model];
+
+        ayaneo_ec_timing.latch_us = caps->latch_us ? caps->latch_us :
+                                    AYANEO_LED_WRITE_DELAY_US;
+        ayaneo_ec_timing.write_cycle_us = caps->write_cycle_us ? caps->write_cycle_us :
+                                          AYANEO_LED_WRITE_DELAY_LEGACY_US;
+        ayaneo_ec_timing.resume_ms = caps->resume_ms ? caps->resume_ms :
+                                     AYANEO_LED_SUSPEND_RESUME_DELAY_MS;
+}
+
+static void ayaneo_ec_timing_apply_params(void)
+{
+        if (latch_delay_us >= 0)
+                ayaneo_ec_timing.latch_us = latch_delay_us;
+        if (write_cycle_delay_us >= 0)
+                ayaneo_ec_timing.write_cycle_us = write_cycle_delay_us;
+        if (resume_delay_ms >= 0)
+                ayaneo_ec_timing.resume_ms = resume_delay_ms;
+}
+
+static unsigned int ayaneo_ec_ram_write_delay_us(u8 index)
+{
+        switch (index) {
+                case AYANEO_LED_MC_ADDR_CLOSE_1:
+                case AYANEO_LED_MC_ADDR_CLOSE_2:
+                        return ayaneo_ec_timing.latch_us;
+                default:
+                        return 0;
+        }
+}
+
+/* Pace consecutive MCU writes. A batch never holds the global lock across
+ * the delay. The delay sleeps, so it is recorded as wall-clock time; the CPU
+ * time it costs is next to nothing.
+ */
+static void ayaneo_led_mc_write_delay(unsigned int delay_us)
+{
+        u64 start;
+
+        ayaneo_ec_lock_release();
+
+        start = ktime_get_ns();
+        ayaneo_ec->delay(delay_us);
+        ayaneo_stats_hist_add(&ayaneo_stats.delay_wall, ktime_get_ns() - start);
+}
+
+/* Preemptible frames:
+ *  kthread_stop() and the freezer both wait for the writer thread to reach a
+ *  point where it may stop. Rather than only stopping between frames, the
+ *  regmap buses call ayaneo_led_mc_frame_abort() before every EC write they
+ *  issue on behalf of the writer, so stopping or freezing it waits for at most
+ *  one EC write and the MCU delay that follows it. Once a frame is aborted all
+ *  of its remaining writes fail with -EINTR without touching the EC.
  *
- *  Updates to ayaneo_led_mc_update_required and ayaneo_led_mc_update_color are
- *  syncronised by ayaneo_led_mc_update_lock to prevent a race condition between
- *  the writer thread and the brightness set function.
+ *  A write cycle is never split, so the MCU is always left in a state a later
+ *  frame can build on. Colors whose write or latch failed are dropped from the
+ *  register cache, the enable sequence is redone, and the generation is not
+ *  recorded as applied, so the writer repeats the frame once it is thawed.
  *
- *  During suspend kthread_stop is called which causes the writer thread to
- *  terminate after its current iteration. The writer thread is restarted during
- *  resume to allow updates to continue.
+ *  The time between two cancellation points is recorded in the preempt_step
+ *  histogram of the stats file; its highest bucket bounds how long suspend and
+ *  module removal may wait for the writer.
  */
 static struct task_struct *ayaneo_led_mc_writer_thread;
-static int ayaneo_led_mc_update_required;
-static u8 ayaneo_led_mc_update_color[3];
-DEFINE_RWLOCK(ayaneo_led_mc_update_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ayaneo_led_mc_writer_wait);
+static bool ayaneo_led_mc_frame_aborted;
+static u64 ayaneo_led_mc_preempt_ns;
 
-static void ayaneo_led_mc_scale_color(u8 *color, u8 max_value)
+static bool ayaneo_led_mc_writer_interrupted(void)
 {
-        for (int i = 0; i < 3; i++)
-        {
-                int c_color = (int)color[i] * (int)max_value / 255;
+        return kthread_should_stop() || freezing(current);
+}
 
-                // prevents left-right discrepancy when brightness/color are low
-                if (c_color == 0 && color[i] > 0)
-                        c_color = 1;
+/* Records a cancellation point of the current frame */
+static void ayaneo_led_mc_frame_preempt_point(void)
+{
+        u64 now = ktime_get_ns();
 
-                color[i] = (u8)c_color;
-        }
+        ayaneo_stats_hist_add(&ayaneo_stats.preempt_step, now - ayaneo_led_mc_preempt_ns);
+        ayaneo_led_mc_preempt_ns = now;
 }
 
-static void ayaneo_led_mc_brightness_apply(u8 *color)
+static void ayaneo_led_mc_frame_begin(void)
 {
-        u8 color_l[3]; /* Left joystick ring */
-        u8 color_r[3]; /* Right joystick ring */
-        u8 color_b[3]; /* AyaSpace Button (KUN Only) */
+        ayaneo_led_mc_frame_aborted = false;
+        ayaneo_led_mc_preempt_ns = ktime_get_ns();
+}
 
-        u8 zones[4] = {3, 6, 9, 12};
+/* Returns true if the writer must give up the current frame. Always false
+ * outside of the writer thread.
+ */
+static bool ayaneo_led_mc_frame_abort(void)
+{
+        if (current != ayaneo_led_mc_writer_thread)
+                return false;
 
-        for (int i = 0; i < 3; i++)
-        {
-                color_l[i] = color[i];
-                color_r[i] = color[i];
-                color_b[i] = color[i];
-        }
+        if (ayaneo_led_mc_frame_aborted)
+                return true;
 
-        ayaneo_led_mc_scale_color(color_l, 192);
-        ayaneo_led_mc_scale_color(color_r, 192);
-        ayaneo_led_mc_scale_color(color_b, 192);
+        ayaneo_led_mc_frame_preempt_point();
+        ayaneo_led_mc_frame_aborted = ayaneo_led_mc_writer_interrupted();
 
-        switch (model) {
-                case air:
-                case air_pro:
-                case air_1s:
-                        ayaneo_led_mc_legacy_on();
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case air_1s_limited:
-                        ayaneo_led_mc_scale_color(color_r, 204);
-                        ayaneo_led_mc_legacy_on();
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case geek:
-                case geek_1s:
-                case ayaneo_2:
-                case ayaneo_2s:
-                        ayaneo_led_mc_legacy_on();
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case air_plus_mendo:
-                        ayaneo_led_mc_scale_color(color_l, 64);
-                        ayaneo_led_mc_scale_color(color_r, 32);
-                        ayaneo_led_mc_legacy_on();
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case air_plus:
-                        ayaneo_led_mc_scale_color(color_l, 64);
-                        ayaneo_led_mc_scale_color(color_r, 32);
-                        ayaneo_led_mc_on();
-                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case slide:
-                        ayaneo_led_mc_on();
-                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
-                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
-                        break;
-                case kun:
-                        ayaneo_led_mc_legacy_on();
-                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_LEFT, color_l);
-                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_RIGHT, color_r);
-                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_BUTTON, color_b);
-                        break;
-                default:
-                        break;
+        return ayaneo_led_mc_frame_aborted;
+}
+
+/* Sleeps for ms unless the frame is aborted meanwhile */
+static void ayaneo_led_mc_frame_sleep(unsigned int ms)
+{
+        if (current != ayaneo_led_mc_writer_thread) {
+                msleep(ms);
+                return;
         }
+
+        if (ayaneo_led_mc_frame_abort())
+                return;
+
+        wait_event_interruptible_timeout(ayaneo_led_mc_writer_wait,
+                                         ayaneo_led_mc_writer_interrupted(),
+                                         msecs_to_jiffies(ms));
+
+        /* Stopping or freezing wakes the wait, it is not part of a step */
+        ayaneo_led_mc_preempt_ns = ktime_get_ns();
+        ayaneo_led_mc_frame_abort();
 }
 
-int ayaneo_led_mc_writer(void *pv);
-int ayaneo_led_mc_writer(void *pv)
+/* Regmap buses
+ *  All EC access goes through a regmap, so redundant color writes are dropped
+ *  by its register cache, regcache_sync() can restore the LEDs after the
+ *  microcontroller was reset, and regmap debugfs and tracepoints come for
+ *  free. The regmap lock is an EC batch, so regmap debugfs access is
+ *  serialised against the writer thread.
+ *
+ *  ayaneo_ec_ram_bus (dedicated microcontroller) maps registers 1:1 to the
+ *  0xd1xx EC ram window.
+ *
+ *  ayaneo_ec_legacy_bus (ACPI controller) maps registers below 0x100 to the
+ *  ACPI EC, and exposes every LED subpixel as a virtual register
+ *  AYANEO_LED_LEGACY_REG(group, pos). Writing a run of virtual registers
+ *  performs one PWM_CONTROL/POS/BRIGHTNESS/MODE write cycle per subpixel, or
+ *  a single batched cycle for the whole run where the model supports it.
+ *
+ *  On both buses only the subpixel color registers are cached; everything
+ *  else is a command and is volatile.
+ */
+#define AYANEO_LED_COLOR_POS_FIRST    3
+#define AYANEO_LED_COLOR_POS_LAST     14
+#define AYANEO_LED_RING_POS           16
+
+#define AYANEO_LED_LEGACY_REG(group, pos)       (((group) << 8) | (pos))
+#define AYANEO_LED_LEGACY_REG_MAX               AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_BUTTON, 0xff)
+
+static struct regmap *ayaneo_led_mc_regmap;
+
+static void ayaneo_ec_regmap_lock(void *arg)
 {
-        pr_info("Writer thread started.\n");
-        int count;
-        u8 color[3];
+        ayaneo_ec_batch_begin();
+}
+
+static void ayaneo_ec_regmap_unlock(void *arg)
+{
+        ayaneo_ec_batch_end();
+}
+
+static int ayaneo_ec_ram_bus_gather_write(void *context, const void *reg, size_t reg_size,
+                                          const void *val, size_t val_size)
+{
+        u8 index = *(const u8 *)reg;
+        unsigned int delay_us = 0;
+        int ret;
+
+        if (ayaneo_led_mc_frame_abort())
+                return -EINTR;
+
+        ret = ec_write_ram_range(index, val, val_size);
+
+        for (size_t i = 0; i < val_size; i++)
+                delay_us = max(delay_us, ayaneo_ec_ram_write_delay_us(index + i));
+        if (delay_us)
+                ayaneo_led_mc_write_delay(delay_us);
+
+        return ret;
+}
+
+static int ayaneo_ec_ram_bus_write(void *context, const void *data, size_t count)
+{
+        return ayaneo_ec_ram_bus_gather_write(context, data, 1,
+                                              (const u8 *)data + 1, count - 1);
+}
+
+static int ayaneo_ec_ram_bus_read(void *context, const void *reg, size_t reg_size,
+                                  void *val, size_t val_size)
+{
+        return ec_read_ram_range(*(const u8 *)reg, val, val_size);
+}
+
+static const struct regmap_bus ayaneo_ec_ram_bus = {
+        .write = ayaneo_ec_ram_bus_write,
+        .gather_write = ayaneo_ec_ram_bus_gather_write,
+        .read = ayaneo_ec_ram_bus_read,
+};
+
+static const struct regmap_range ayaneo_ec_ram_color_ranges[] = {
+        regmap_reg_range(AYANEO_LED_MC_ADDR_R + AYANEO_LED_COLOR_POS_FIRST,
+                         AYANEO_LED_MC_ADDR_R + AYANEO_LED_COLOR_POS_LAST),
+        regmap_reg_range(AYANEO_LED_MC_ADDR_L + AYANEO_LED_COLOR_POS_FIRST,
+                         AYANEO_LED_MC_ADDR_L + AYANEO_LED_COLOR_POS_LAST),
+};
+
+static const struct regmap_access_table ayaneo_ec_ram_volatile_table = {
+        .no_ranges = ayaneo_ec_ram_color_ranges,
+        .n_no_ranges = ARRAY_SIZE(ayaneo_ec_ram_color_ranges),
+};
+
+static const struct regmap_config ayaneo_ec_ram_regmap_config = {
+        .name = "ec_ram",
+        .reg_bits = 8,
+        .val_bits = 8,
+        .max_register = 0xff,
+        .volatile_table = &ayaneo_ec_ram_volatile_table,
+        .cache_type = REGCACHE_MAPLE,
+        .lock = ayaneo_ec_regmap_lock,
+        .unlock = ayaneo_ec_regmap_unlock,
+};
+
+/* Batched legacy writes:
+ *  Some ACPI controllers may accept a whole run of position/brightness pairs
+ *  inside a single WRITE/HOLD cycle of AYANEO_LED_MODE_REG, in which case a
+ *  run of subpixels costs one global lock round-trip and one MCU delay
+ *  instead of one per subpixel. The batch sends the registers in a different
+ *  order than the per-subpixel cycle, so it is only used on models whose
+ *  capabilities have legacy_batch set, none so far, or when forced with
+ *  legacy_batch=1.
+ */
+static int legacy_batch = -1;
+module_param(legacy_batch, int, 0444);
+MODULE_PARM_DESC(legacy_batch,
+                 "Batch legacy EC color writes (-1 = model default, 0 = off, 1 = on)");
+
+static bool ayaneo_led_mc_legacy_batch_supported(void)
+{
+        if (legacy_batch >= 0)
+                return legacy_batch;
+
+        return ayaneo_model_caps[model].legacy_batch;
+}
+
+static int ayaneo_ec_write(u8 addr, u8 val)
+{
+        int ret;
+
+        ret = ayaneo_ec->ec_write(addr, val);
+        trace_ayaneo_ec_write(addr, val, ret);
+
+        atomic64_inc(&ayaneo_stats.ec_writes);
+        if (ret)
+                atomic64_inc(&ayaneo_stats.ec_write_failures);
+
+        return ret;
+}
+
+static int ayaneo_ec_legacy_write_one(u8 group, u8 pos, u8 brightness)
+{
+        int ret;
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ret = ayaneo_ec_write(AYANEO_LED_PWM_CONTROL, group);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_POS, pos);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_BRIGHTNESS, brightness);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_WRITE);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        ayaneo_led_mc_write_delay(ayaneo_ec_timing.write_cycle_us);
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return ret;
+}
+
+static int ayaneo_ec_legacy_write_batch(u8 group, u8 pos, const u8 *brightness,
+                                        size_t count)
+{
+        int ret;
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ret = ayaneo_ec_write(AYANEO_LED_PWM_CONTROL, group);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_WRITE);
+        for (size_t i = 0; i < count && !ret; i++) {
+                ret = ayaneo_ec_write(AYANEO_LED_POS, pos + i);
+                if (!ret)
+                        ret = ayaneo_ec_write(AYANEO_LED_BRIGHTNESS, brightness[i]);
+        }
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        ayaneo_led_mc_write_delay(ayaneo_ec_timing.write_cycle_us);
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return ret;
+}
+
+static int ayaneo_ec_legacy_bus_gather_write(void *context, const void *reg, size_t reg_size,
+                                             const void *val, size_t val_size)
+{
+        const u8 *addr = reg;
+        const u8 *buf = val;
+        unsigned int index = (addr[0] << 8) | addr[1];
+        u8 group = index >> 8;
+        u8 pos = index & 0xff;
+        int ret = 0;
+
+        if (ayaneo_led_mc_frame_abort())
+                return -EINTR;
+
+        if (index < 0x100) {
+                if (!lock_global_acpi_lock())
+                        return -EBUSY;
+
+                for (size_t i = 0; i < val_size && !ret; i++)
+                        ret = ayaneo_ec_write(index + i, buf[i]);
+
+                if (!unlock_global_acpi_lock())
+                        return -EBUSY;
+
+                return ret;
+        }
+
+        if (val_size > 1 && ayaneo_led_mc_legacy_batch_supported())
+                return ayaneo_ec_legacy_write_batch(group, pos, buf, val_size);
+
+        /* Every write cycle takes a full MCU delay, so each one may be preempted */
+        for (size_t i = 0; i < val_size && !ret; i++) {
+                if (i && ayaneo_led_mc_frame_abort())
+                        return -EINTR;
+
+                ret = ayaneo_ec_legacy_write_one(group, pos + i, buf[i]);
+        }
+
+        return ret;
+}
+
+static int ayaneo_ec_legacy_bus_write(void *context, const void *data, size_t count)
+{
+        return ayaneo_ec_legacy_bus_gather_write(context, data, 2,
+                                                 (const u8 *)data + 2, count - 2);
+}
+
+static int ayaneo_ec_legacy_bus_read(void *context, const void *reg, size_t reg_size,
+                                     void *val, size_t val_size)
+{
+        const u8 *addr = reg;
+        u8 *buf = val;
+        unsigned int index = (addr[0] << 8) | addr[1];
+        int ret = 0;
+
+        /* The LED subpixels are write only */
+        if (index >= 0x100)
+                return -EIO;
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        for (size_t i = 0; i < val_size && !ret; i++)
+                ret = ayaneo_ec->ec_read(index + i, &buf[i]);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return ret;
+}
+
+static const struct regmap_bus ayaneo_ec_legacy_bus = {
+        .write = ayaneo_ec_legacy_bus_write,
+        .gather_write = ayaneo_ec_legacy_bus_gather_write,
+        .read = ayaneo_ec_legacy_bus_read,
+};
+
+static const struct regmap_range ayaneo_ec_legacy_access_ranges[] = {
+        regmap_reg_range(AYANEO_LED_PWM_CONTROL, AYANEO_LED_PWM_CONTROL),
+        regmap_reg_range(AYANEO_LED_POS, AYANEO_LED_BRIGHTNESS),
+        regmap_reg_range(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_REG),
+        regmap_reg_range(AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_LEFT, 0), AYANEO_LED_LEGACY_REG_MAX),
+};
+
+static const struct regmap_access_table ayaneo_ec_legacy_access_table = {
+        .yes_ranges = ayaneo_ec_legacy_access_ranges,
+        .n_yes_ranges = ARRAY_SIZE(ayaneo_ec_legacy_access_ranges),
+};
+
+static const struct regmap_range ayaneo_ec_legacy_color_ranges[] = {
+        regmap_reg_range(AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_LEFT, AYANEO_LED_COLOR_POS_FIRST),
+                         AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_LEFT, AYANEO_LED_COLOR_POS_LAST)),
+        regmap_reg_range(AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_RIGHT, AYANEO_LED_COLOR_POS_FIRST),
+                         AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_RIGHT, AYANEO_LED_COLOR_POS_LAST)),
+        regmap_reg_range(AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_BUTTON, AYANEO_LED_COLOR_POS_FIRST),
+                         AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_BUTTON, AYANEO_LED_COLOR_POS_LAST)),
+};
+
+static const struct regmap_access_table ayaneo_ec_legacy_volatile_table = {
+        .no_ranges = ayaneo_ec_legacy_color_ranges,
+        .n_no_ranges = ARRAY_SIZE(ayaneo_ec_legacy_color_ranges),
+};
+
+static const struct regmap_config ayaneo_ec_legacy_regmap_config = {
+        .name = "acpi_ec",
+        .reg_bits = 16,
+        .val_bits = 8,
+        .max_register = AYANEO_LED_LEGACY_REG_MAX,
+        .wr_table = &ayaneo_ec_legacy_access_table,
+        .rd_table = &ayaneo_ec_legacy_access_table,
+        .volatile_table = &ayaneo_ec_legacy_volatile_table,
+        .cache_type = REGCACHE_MAPLE,
+        .lock = ayaneo_ec_regmap_lock,
+        .unlock = ayaneo_ec_regmap_unlock,
+};
+
+/* Timing calibration
+ *  With ec_calibrate set, or on a write to the calibrate debugfs file, the
+ *  driver measures how long the MCU actually takes to consume a write. It
+ *  writes a test subpixel and polls the register the MCU acknowledges the
+ *  write in: the close register of a dedicated MCU, AYANEO_LED_MODE_REG of an
+ *  ACPI controller. The slowest of several trials, doubled for margin, becomes
+ *  the new delay. It is never made longer than the model default.
+ *
+ *  Firmware that does not acknowledge writes in those registers cannot be
+ *  measured, and keeps the model default. The resume delay is never
+ *  calibrated, there is nothing to read back for it.
+ *
+ *  ec_calibrate runs on the writer thread, which gives up between trials when
+ *  it is stopped or frozen; the model defaults are kept and the next resume
+ *  tries again.
+ */
+#define AYANEO_EC_CALIBRATE_TRIALS    8
+#define AYANEO_EC_CALIBRATE_POLL_US   10
+#define AYANEO_EC_CALIBRATE_MIN_US    50
+
+static bool ec_calibrate;
+module_param(ec_calibrate, bool, 0444);
+MODULE_PARM_DESC(ec_calibrate, "Measure the EC write timing of this device on load");
+
+/* Polls until read() stops returning busy, returns the time that took in
+ * microseconds. Like ayaneo_led_mc_write_delay(), the global lock is given
+ * back to the firmware while waiting on the MCU, even inside a batch.
+ */
+static int ayaneo_ec_calibrate_poll(int (*read)(u8 *val), u8 busy, unsigned int limit_us)
+{
+        u64 start = ktime_get_ns();
+        u64 elapsed;
+        u8 val;
+        int ret;
+
+        do {
+                ayaneo_ec_lock_release();
+                usleep_range(AYANEO_EC_CALIBRATE_POLL_US, AYANEO_EC_CALIBRATE_POLL_US * 2);
+
+                ret = read(&val);
+                if (ret)
+                        return ret;
+
+                elapsed = ktime_get_ns() - start;
+                if (val != busy)
+                        return div_u64(elapsed, NSEC_PER_USEC);
+        } while (elapsed < (u64)limit_us * NSEC_PER_USEC);
+
+        return -ETIMEDOUT;
+}
+
+static int ayaneo_ec_ram_calibrate_read(u8 *val)
+{
+        return ec_read_ram(AYANEO_LED_MC_ADDR_CLOSE_2, val);
+}
+
+static int ayaneo_ec_ram_calibrate_trial(unsigned int limit_us)
+{
+        int ret;
+
+        ret = ec_write_ram(AYANEO_LED_MC_ADDR_L + AYANEO_LED_COLOR_POS_FIRST, 0x00);
+        if (!ret)
+                ret = ec_write_ram(AYANEO_LED_MC_ADDR_CLOSE_2, 0x01);
+        if (ret)
+                return ret;
+
+        return ayaneo_ec_calibrate_poll(ayaneo_ec_ram_calibrate_read, 0x01, limit_us);
+}
+
+static int ayaneo_ec_legacy_calibrate_read(u8 *val)
+{
+        int ret;
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ret = ayaneo_ec->ec_read(AYANEO_LED_MODE_REG, val);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return ret;
+}
+
+static int ayaneo_ec_legacy_calibrate_trial(unsigned int limit_us)
+{
+        int ret;
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ret = ayaneo_ec_write(AYANEO_LED_PWM_CONTROL, AYANEO_LED_GROUP_LEFT);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_POS, AYANEO_LED_COLOR_POS_FIRST);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_BRIGHTNESS, 0x00);
+        if (!ret)
+                ret = ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_WRITE);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        if (!ret)
+                ret = ayaneo_ec_calibrate_poll(ayaneo_ec_legacy_calibrate_read,
+                                               AYANEO_LED_MODE_WRITE, limit_us);
+
+        if (!lock_global_acpi_lock())
+                return -EBUSY;
+
+        ayaneo_ec_write(AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+
+        if (!unlock_global_acpi_lock())
+                return -EBUSY;
+
+        return ret;
+}
+
+static int ayaneo_ec_calibrate(void)
+{
+        int (*trial)(unsigned int limit_us);
+        unsigned int *delay_us;
+        unsigned int test_reg;
+        unsigned int default_us;
+        int slowest = 0;
+        int ret = 0;
+
+        if (ayaneo_ec_ram_supported()) {
+                trial = ayaneo_ec_ram_calibrate_trial;
+                delay_us = &ayaneo_ec_timing.latch_us;
+                test_reg = AYANEO_LED_MC_ADDR_L + AYANEO_LED_COLOR_POS_FIRST;
+                if (latch_delay_us >= 0)
+                        return 0;
+        } else {
+                trial = ayaneo_ec_legacy_calibrate_trial;
+                delay_us = &ayaneo_ec_timing.write_cycle_us;
+                test_reg = AYANEO_LED_LEGACY_REG(AYANEO_LED_GROUP_LEFT, AYANEO_LED_COLOR_POS_FIRST);
+                if (write_cycle_delay_us >= 0)
+                        return 0;
+        }
+
+        /* Start over from the model defaults */
+        ayaneo_ec_timing_defaults();
+        ayaneo_ec_timing.calibrated = false;
+        default_us = *delay_us;
+
+        ayaneo_ec_batch_begin();
+
+        for (int i = 0; i < AYANEO_EC_CALIBRATE_TRIALS && ret >= 0; i++) {
+                if (ayaneo_led_mc_frame_abort()) {
+                        ret = -EINTR;
+                        break;
+                }
+
+                ret = trial(default_us * 2);
+                slowest = max(slowest, ret);
+        }
+
+        /* The test subpixel was written behind the cache's back */
+        regcache_drop_region(ayaneo_led_mc_regmap, test_reg, test_reg);
+
+        if (ret >= 0) {
+                *delay_us = clamp_t(unsigned int, slowest * 2,
+                                    AYANEO_EC_CALIBRATE_MIN_US, default_us);
+                ayaneo_ec_timing.calibrated = true;
+        }
+
+        ayaneo_ec_timing_apply_params();
+
+        ayaneo_ec_batch_end();
+
+        if (ret < 0) {
+                pr_info("Timing calibration failed (%d), keeping %u us\n", ret, *delay_us);
+                return ret;
+        }
+
+        pr_info("Calibrated write delay to %u us (slowest write %d us)\n", *delay_us, slowest);
+
+        return 0;
+}
+
+/* Function Summary
+ * AYANEO devices can be largely divided into 2 groups; modern and legacy.
+ *   - Legacy devices use a microcontroller either embedded into or controlled via
+ *     the system's ACPI controller.
+ *   - Modern devices use a dedicated microcontroller and communicate via shared
+ *     memory.
+ *
+ * The control scheme is largely shared between both device types and many of
+ * the command values are shared.
+ *
+ * ayaneo_led_mc_set / ayaneo_led_mc_legacy_set
+ *       Sets the value of a single address or subpixel
+ *
+ * ayaneo_led_mc_latch
+ *       Latches every subpixel written to a group since the last latch
+ *       (dedicated microcontroller only).
+ *
+ * ayaneo_led_mc_release / ayaneo_led_mc_legacy_release
+ *       Releases control of the LEDs back to the microcontroller.
+ *       This function is abstracted by ayaneo_led_mc_release_control.
+ *
+ * ayaneo_led_mc_hold / ayaneo_led_mc_legacy_hold
+ *       Takes and holds control of the LEDs from the microcontroller.
+ *       This function is abstracted by ayaneo_led_mc_take_control.
+ *
+ * ayaneo_led_mc_intensity / ayaneo_led_mc_legacy_intensity
+ *       Sets the values of all of the LEDs in the zones of a given group.
+ *
+ * ayaneo_led_mc_off / ayaneo_led_mc_legacy_off
+ *       Instructs the microcontroller to disable output for the given group.
+ *
+ * ayaneo_led_mc_on / ayaneo_led_mc_legacy_on
+ *       Instructs the microcontroller to enable output for the given group.
+ *       The enable sequence is only sent if output is not already known to be
+ *       enabled; ayaneo_led_mc_off, ayaneo_led_mc_reset and
+ *       ayaneo_led_mc_release (and their legacy counterparts) forget that
+ *       state so the next ayaneo_led_mc_on replays it.
+ *
+ * ayaneo_led_mc_reset / ayaneo_led_mc_legacy_reset
+ *       Reverts all of the microcontroller internal registers to power on
+ *       defaults.
+ *
+ * ayaneo_led_mc_restore / ayaneo_led_mc_legacy_restore
+ *       Rewrites the cached colors after a reset.
+ *
+ * Color writes go through the regmap cache, so only subpixels whose value
+ * actually changes are written and an unchanged frame produces no EC traffic.
+ * A reset marks the cache dirty, and the next frame restores the cached colors
+ * with regcache_sync() before writing whatever changed.
+ */
+
+/* Set once the microcontroller has been enabled and switched to the static
+ * color animation.
+ */
+static bool ayaneo_led_mc_enabled;
+
+/* Set when the microcontroller lost the colors held in the register cache */
+static bool ayaneo_led_mc_cache_dirty;
+
+static void ayaneo_led_mc_cache_mark_dirty(void)
+{
+        regcache_mark_dirty(ayaneo_led_mc_regmap);
+        ayaneo_led_mc_cache_dirty = true;
+}
+
+/* Returns true if the cache holds any color. Only colors are cached, so this
+ * is whether regcache_sync() has anything to write back.
+ */
+static bool ayaneo_led_mc_cache_populated(void)
+{
+        const struct regmap_range *ranges = ayaneo_ec_legacy_color_ranges;
+        size_t n_ranges = ARRAY_SIZE(ayaneo_ec_legacy_color_ranges);
+        bool populated = false;
+        unsigned int val;
+
+        if (ayaneo_ec_ram_supported()) {
+                ranges = ayaneo_ec_ram_color_ranges;
+                n_ranges = ARRAY_SIZE(ayaneo_ec_ram_color_ranges);
+        }
+
+        regcache_cache_only(ayaneo_led_mc_regmap, true);
+        for (size_t i = 0; i < n_ranges && !populated; i++) {
+                for (unsigned int reg = ranges[i].range_min;
+                     reg <= ranges[i].range_max && !populated; reg++)
+                        populated = !regmap_read(ayaneo_led_mc_regmap, reg, &val);
+        }
+        regcache_cache_only(ayaneo_led_mc_regmap, false);
+
+        return populated;
+}
+
+/* Writes the cached colors back after the microcontroller was reset. Returns
+ * true if anything was restored, in which case the caller must commit. A
+ * failed sync is retried on the next frame.
+ */
+static bool ayaneo_led_mc_cache_sync(void)
+{
+        bool populated;
+
+        if (!ayaneo_led_mc_cache_dirty)
+                return false;
+
+        populated = ayaneo_led_mc_cache_populated();
+        ayaneo_led_mc_cache_dirty = regcache_sync(ayaneo_led_mc_regmap) != 0;
+
+        return populated && !ayaneo_led_mc_cache_dirty;
+}
+
+/* Desired subpixel values of one group, indexed by position */
+struct ayaneo_led_mc_ring {
+        u8 values[AYANEO_LED_RING_POS];
+        bool wanted[AYANEO_LED_RING_POS];
+};
+
+static void ayaneo_led_mc_ring_zone(struct ayaneo_led_mc_ring *ring, u8 zone, const u8 *color)
+{
+        for (int i = 0; i < 3; i++) {
+                ring->values[zone + i] = color[i];
+                ring->wanted[zone + i] = true;
+        }
+}
+
+/* Writes a ring through the register cache, base being the register of
+ * position 0. Only subpixels that differ from the cache are written, as runs
+ * of consecutive registers. With merge set, unchanged subpixels between two
+ * changed ones are rewritten rather than splitting the run, for transports
+ * where a longer write is cheaper than an extra one. Returns true if anything
+ * was written, in which case the caller must commit the group.
+ */
+static bool ayaneo_led_mc_write_ring(unsigned int base, const struct ayaneo_led_mc_ring *ring,
+                                     bool merge)
+{
+        bool changed[AYANEO_LED_RING_POS] = { false };
+        bool dirty = false;
+        unsigned int cur;
+        int start;
+        int end;
+        int pos;
+
+        regcache_cache_only(ayaneo_led_mc_regmap, true);
+        for (pos = 0; pos < AYANEO_LED_RING_POS; pos++) {
+                if (!ring->wanted[pos])
+                        continue;
+
+                changed[pos] = regmap_read(ayaneo_led_mc_regmap, base + pos, &cur) ||
+                               cur != ring->values[pos];
+        }
+        regcache_cache_only(ayaneo_led_mc_regmap, false);
+
+        for (pos = 0; pos < AYANEO_LED_RING_POS; pos++) {
+                if (!changed[pos])
+                        continue;
+
+                start = pos;
+                end = pos;
+                for (pos++; pos < AYANEO_LED_RING_POS &&
+                            (changed[pos] || (merge && ring->wanted[pos])); pos++) {
+                        if (changed[pos])
+                                end = pos;
+                }
+
+                if (regmap_bulk_write(ayaneo_led_mc_regmap, base + start,
+                                      &ring->values[start], end - start + 1))
+                        regcache_drop_region(ayaneo_led_mc_regmap, base + start, base + end);
+
+                dirty = true;
+                pos = end;
+        }
+
+        return dirty;
+}
+
+/* Forgets the cached colors of a ring whose commit failed, so the next frame
+ * writes all of them again.
+ */
+static void ayaneo_led_mc_ring_drop(unsigned int base)
+{
+        regcache_drop_region(ayaneo_led_mc_regmap, base + AYANEO_LED_COLOR_POS_FIRST,
+                             base + AYANEO_LED_COLOR_POS_LAST);
+}
+
+/* Forgets the cached colors of every ring */
+static void ayaneo_led_mc_cache_drop(void)
+{
+        if (ayaneo_ec_ram_supported()) {
+                ayaneo_led_mc_ring_drop(AYANEO_LED_MC_ADDR_L);
+                ayaneo_led_mc_ring_drop(AYANEO_LED_MC_ADDR_R);
+                return;
+        }
+
+        for (u8 group = AYANEO_LED_GROUP_LEFT; group <= AYANEO_LED_GROUP_BUTTON; group++)
+                ayaneo_led_mc_ring_drop(AYANEO_LED_LEGACY_REG(group, 0));
+}
+
+/* Dedicated microcontroller methods */
+static void ayaneo_led_mc_group_addr(u8 group, u8 *led_offset, u8 *close_cmd)
+{
+        if (group < 2)
+        {
+                *led_offset = AYANEO_LED_MC_ADDR_L;
+                *close_cmd = AYANEO_LED_MC_ADDR_CLOSE_2;
+        }
+        else
+        {
+                *led_offset = AYANEO_LED_MC_ADDR_R;
+                *close_cmd = AYANEO_LED_MC_ADDR_CLOSE_1;
+        }
+}
+
+static int ayaneo_led_mc_set(u8 group, u8 pos, u8 brightness)
+{
+        u8 led_offset;
+        u8 close_cmd;
+        int ret;
+
+        ayaneo_led_mc_group_addr(group, &led_offset, &close_cmd);
+
+        ret = regmap_write(ayaneo_led_mc_regmap, led_offset + pos, brightness);
+        if (!ret)
+                ret = regmap_write(ayaneo_led_mc_regmap, close_cmd, 0x01);
+
+        return ret;
+}
+
+/* Frame mode:
+ *  Color updates write the subpixels of a ring without latching them, and
+ *  ayaneo_led_mc_latch then latches every written subpixel of the group at
+ *  once. This halves the EC RAM writes of a color update and makes all zones
+ *  of a ring change together instead of one by one.
+ */
+static int ayaneo_led_mc_latch(u8 group)
+{
+        u8 led_offset;
+        u8 close_cmd;
+
+        ayaneo_led_mc_group_addr(group, &led_offset, &close_cmd);
+
+        return regmap_write(ayaneo_led_mc_regmap, close_cmd, 0x01);
+}
+
+static void ayaneo_led_mc_release(void)
+{
+        ayaneo_led_mc_enabled = false;
+
+        regmap_write(ayaneo_led_mc_regmap, AYANEO_LED_MC_MODE_ADDR, AYANEO_LED_MC_MODE_RELEASE);
+}
+
+static void ayaneo_led_mc_hold(void)
+{
+        regmap_write(ayaneo_led_mc_regmap, AYANEO_LED_MC_MODE_ADDR, AYANEO_LED_MC_MODE_HOLD);
+
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+}
+
+/* The subpixels of a ring sit in contiguous EC ram, so every run of changed
+ * subpixels is written with a single range write; when the whole color
+ * changes that is one write for the entire ring.
+ */
+static void ayaneo_led_mc_intensity(u8 group, u8 *color, u8 zones[])
+{
+        struct ayaneo_led_mc_ring ring = { };
+        u8 led_offset;
+        u8 close_cmd;
+        int zone;
+
+        for (zone = 0; zone < 4; zone++)
+                ayaneo_led_mc_ring_zone(&ring, zones[zone], color);
+
+        ayaneo_led_mc_group_addr(group, &led_offset, &close_cmd);
+
+        if (ayaneo_led_mc_write_ring(led_offset, &ring, ayaneo_ec_ram_autoinc_supported()) &&
+            (ayaneo_led_mc_latch(group) ||
+             ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00)))
+                ayaneo_led_mc_ring_drop(led_offset);
+}
+
+static void ayaneo_led_mc_restore(void)
+{
+        if (!ayaneo_led_mc_cache_sync())
+                return;
+
+        if (ayaneo_led_mc_latch(AYANEO_LED_GROUP_LEFT) ||
+            ayaneo_led_mc_latch(AYANEO_LED_GROUP_RIGHT) ||
+            ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00))
+                ayaneo_led_mc_cache_mark_dirty();
+}
+
+static void ayaneo_led_mc_off(void)
+{
+        ayaneo_led_mc_enabled = false;
+
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+}
+
+/* Commands that put a ring into the static color mode, in the order they
+ * are sent to both rings.
+ */
+static const u8 ayaneo_led_mc_on_cmds[][2] = {
+        { AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON },
+        { AYANEO_LED_CMD_PATTERN_ADDR, AYANEO_LED_CMD_PATTERN_OFF },
+        { AYANEO_LED_CMD_FADE_ADDR, AYANEO_LED_CMD_FADE_OFF },
+        /* Set static color animation */
+        { AYANEO_LED_CMD_ANIM_1_ADDR, AYANEO_LED_CMD_ANIM_STATIC },
+        { AYANEO_LED_CMD_ANIM_2_ADDR, AYANEO_LED_CMD_ANIM_STATIC },
+        { AYANEO_LED_CMD_ANIM_3_ADDR, AYANEO_LED_CMD_ANIM_STATIC },
+        { AYANEO_LED_CMD_ANIM_4_ADDR, AYANEO_LED_CMD_ANIM_STATIC },
+        { AYANEO_LED_CMD_WATCHDOG_ADDR, AYANEO_LED_CMD_WATCHDOG_ON },
+};
+
+/* Returns the first failed write, in which case the sequence is sent again
+ * on the next frame.
+ */
+static int ayaneo_led_mc_on(void)
+{
+        int ret;
+
+        if (ayaneo_led_mc_enabled)
+                return 0;
+
+        for (int i = 0; i < ARRAY_SIZE(ayaneo_led_mc_on_cmds); i++) {
+                ret = ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
+                        ayaneo_led_mc_on_cmds[i][0], ayaneo_led_mc_on_cmds[i][1]);
+                if (ret)
+                        return ret;
+
+                ret = ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
+                        ayaneo_led_mc_on_cmds[i][0], ayaneo_led_mc_on_cmds[i][1]);
+                if (ret)
+                        return ret;
+        }
+
+        ret = ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+        if (ret)
+                return ret;
+
+        ayaneo_led_mc_restore();
+
+        ayaneo_led_mc_enabled = true;
+
+        return 0;
+}
+
+static void ayaneo_led_mc_reset(void)
+{
+        ayaneo_led_mc_cache_mark_dirty();
+        ayaneo_led_mc_enabled = false;
+
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_RIGHT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+
+        ayaneo_led_mc_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+}
+
+/* ACPI controller methods */
+static int ayaneo_led_mc_legacy_set(u8 group, u8 pos, u8 brightness)
+{
+        return regmap_write(ayaneo_led_mc_regmap, AYANEO_LED_LEGACY_REG(group, pos), brightness);
+}
+
+/* Commits the group if anything was written */
+static void ayaneo_led_mc_legacy_commit(u8 group, bool dirty)
+{
+        if (dirty && ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00))
+                ayaneo_led_mc_ring_drop(AYANEO_LED_LEGACY_REG(group, 0));
+}
+
+static void ayaneo_led_mc_legacy_release(void)
+{
+        ayaneo_led_mc_enabled = false;
+
+        regmap_write(ayaneo_led_mc_regmap, AYANEO_LED_MODE_REG, AYANEO_LED_MODE_RELEASE);
+}
+
+static void ayaneo_led_mc_legacy_hold(void)
+{
+        regmap_write(ayaneo_led_mc_regmap, AYANEO_LED_MODE_REG, AYANEO_LED_MODE_HOLD);
+}
+
+static bool ayaneo_led_mc_legacy_write_ring(u8 group, const struct ayaneo_led_mc_ring *ring)
+{
+        return ayaneo_led_mc_write_ring(AYANEO_LED_LEGACY_REG(group, 0), ring,
+                                        ayaneo_led_mc_legacy_batch_supported());
+}
+
+static void ayaneo_led_mc_legacy_intensity(u8 group, u8 *color, u8 zones[])
+{
+        struct ayaneo_led_mc_ring ring = { };
+        int zone;
+
+        for (zone = 0; zone < 4; zone++) {
+                ayaneo_led_mc_ring_zone(&ring, zones[zone], color);
+        }
+
+        ayaneo_led_mc_legacy_commit(group, ayaneo_led_mc_legacy_write_ring(group, &ring));
+}
+
+/* KUN doesn't use consistant zone mapping for RGB, adjust */
+static void ayaneo_led_mc_legacy_intensity_kun(u8 group, u8 *color)
+{
+        struct ayaneo_led_mc_ring ring = { };
+        u8 zone;
+        u8 remap_color[3];
+
+        if (group == AYANEO_LED_GROUP_BUTTON)
+        {
+                zone = 12;
+                remap_color[0] = color[2];
+                remap_color[1] = color[0];
+                remap_color[2] = color[1];
+                ayaneo_led_mc_ring_zone(&ring, zone, remap_color);
+                ayaneo_led_mc_legacy_commit(AYANEO_LED_GROUP_BUTTON,
+                        ayaneo_led_mc_legacy_write_ring(AYANEO_LED_GROUP_BUTTON, &ring));
+                return;
+        }
+
+        zone = 3;
+        remap_color[0] = color[1];
+        remap_color[1] = color[0];
+        remap_color[2] = color[2];
+        ayaneo_led_mc_ring_zone(&ring, zone, remap_color);
+
+        zone = 6;
+        remap_color[0] = color[1];
+        remap_color[1] = color[2];
+        remap_color[2] = color[0];
+        ayaneo_led_mc_ring_zone(&ring, zone, remap_color);
+
+        zone = 9;
+        remap_color[0] = color[2];
+        remap_color[1] = color[0];
+        remap_color[2] = color[1];
+        ayaneo_led_mc_ring_zone(&ring, zone, remap_color);
+
+        zone = 12;
+        remap_color[0] = color[2];
+        remap_color[1] = color[1];
+        remap_color[2] = color[0];
+        ayaneo_led_mc_ring_zone(&ring, zone, remap_color);
+
+        ayaneo_led_mc_legacy_commit(group, ayaneo_led_mc_legacy_write_ring(group, &ring));
+}
+
+static void ayaneo_led_mc_legacy_off(void)
+{
+        ayaneo_led_mc_enabled = false;
+
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_OFF);
+
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+}
+
+static void ayaneo_led_mc_legacy_restore(void)
+{
+        if (ayaneo_led_mc_cache_sync() &&
+            ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00))
+                ayaneo_led_mc_cache_mark_dirty();
+}
+
+/* Returns the first failed write, see ayaneo_led_mc_on */
+static int ayaneo_led_mc_legacy_on(void)
+{
+        int ret;
+
+        if (ayaneo_led_mc_enabled)
+                return 0;
+
+        ret = ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
+        if (!ret)
+                ret = ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
+                        AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_ON);
+
+        // note: omit for aya flip when implemented, causes unexpected behavior
+        if (!ret)
+                ret = ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+
+        if (ret)
+                return ret;
+
+        ayaneo_led_mc_legacy_restore();
+
+        ayaneo_led_mc_enabled = true;
+
+        return 0;
+}
+
+static void ayaneo_led_mc_legacy_reset(void)
+{
+        ayaneo_led_mc_cache_mark_dirty();
+        ayaneo_led_mc_enabled = false;
+
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_RIGHT,
+                AYANEO_LED_CMD_ENABLE_ADDR, AYANEO_LED_CMD_ENABLE_RESET);
+
+        // note: omit for aya flip when implemented, causes unexpected behavior
+        ayaneo_led_mc_legacy_set(AYANEO_LED_GROUP_LEFT_RIGHT, 0x00, 0x00);
+}
+
+/* Device command abstractions */
+static void ayaneo_led_mc_take_control(void)
+{
+        ayaneo_ec_batch_begin();
+
+        switch (model) {
+                case air:
+                case air_1s:
+                case air_1s_limited:
+                case air_pro:
+                case air_plus_mendo:
+                case geek:
+                case geek_1s:
+                case ayaneo_2:
+                case ayaneo_2s:
+                case kun:
+                        ayaneo_led_mc_legacy_hold();
+                        ayaneo_led_mc_legacy_reset();
+                        ayaneo_led_mc_legacy_off();
+                        break;
+                case air_plus:
+                case slide:
+                        ayaneo_led_mc_hold();
+                        ayaneo_led_mc_reset();
+                        ayaneo_led_mc_off();
+                        break;
+                default:
+                        break;
+                }
+
+        ayaneo_ec_batch_end();
+}
+
+static void ayaneo_led_mc_release_control(void)
+{
+        ayaneo_ec_batch_begin();
+
+        switch (model) {
+                case air:
+                case air_1s:
+                case air_1s_limited:
+                case air_pro:
+                case air_plus_mendo:
+                case geek:
+                case geek_1s:
+                case ayaneo_2:
+                case ayaneo_2s:
+                case kun:
+                        ayaneo_led_mc_legacy_reset();
+                        ayaneo_led_mc_legacy_release();
+                        break;
+                case air_plus:
+                case slide:
+                        ayaneo_led_mc_reset();
+                        ayaneo_led_mc_release();
+                        break;
+                default:
+                        break;
+                }
+
+        ayaneo_ec_batch_end();
+}
+
+/* Incremental resume:
+ *  If the driver still owns the LEDs after resume, the full take-control
+ *  sequence and the settle delay are skipped. Instead the color registers are
+ *  read back and any the firmware changed are dropped from the register cache,
+ *  so the next frame rewrites exactly those. The enable, pattern, fade,
+ *  animation and watchdog registers are read back too, and the enable
+ *  sequence is resent if any of them changed. The ACPI controller's registers
+ *  cannot be read back, so there the enable sequence and all colors are
+ *  rewritten.
+ */
+static bool ayaneo_led_mc_owned(void)
+{
+        unsigned int val;
+
+        if (ayaneo_ec_ram_supported())
+                return !regmap_read(ayaneo_led_mc_regmap, AYANEO_LED_MC_MODE_ADDR, &val) &&
+                       val == AYANEO_LED_MC_MODE_HOLD;
+
+        return !regmap_read(ayaneo_led_mc_regmap, AYANEO_LED_MODE_REG, &val) &&
+               val == AYANEO_LED_MODE_HOLD;
+}
+
+static void ayaneo_led_mc_verify_ring(unsigned int base)
+{
+        unsigned int first = base + AYANEO_LED_COLOR_POS_FIRST;
+        unsigned int last = base + AYANEO_LED_COLOR_POS_LAST;
+        u8 actual[AYANEO_LED_COLOR_POS_LAST - AYANEO_LED_COLOR_POS_FIRST + 1];
+        unsigned int cached;
+        int ret;
+
+        regcache_cache_bypass(ayaneo_led_mc_regmap, true);
+        ret = regmap_bulk_read(ayaneo_led_mc_regmap, first, actual, ARRAY_SIZE(actual));
+        regcache_cache_bypass(ayaneo_led_mc_regmap, false);
+
+        if (ret) {
+                regcache_drop_region(ayaneo_led_mc_regmap, first, last);
+                return;
+        }
+
+        regcache_cache_only(ayaneo_led_mc_regmap, true);
+        for (unsigned int reg = first; reg <= last; reg++) {
+                if (!regmap_read(ayaneo_led_mc_regmap, reg, &cached) &&
+                    cached != actual[reg - first])
+                        regcache_drop_region(ayaneo_led_mc_regmap, reg, reg);
+        }
+        regcache_cache_only(ayaneo_led_mc_regmap, false);
+}
+
+/* Returns true if a ring still holds every command of ayaneo_led_mc_on_cmds */
+static bool ayaneo_led_mc_verify_mode(unsigned int base)
+{
+        unsigned int val;
+
+        for (int i = 0; i < ARRAY_SIZE(ayaneo_led_mc_on_cmds); i++) {
+                if (regmap_read(ayaneo_led_mc_regmap, base + ayaneo_led_mc_on_cmds[i][0], &val) ||
+                    val != ayaneo_led_mc_on_cmds[i][1])
+                        return false;
+        }
+
+        return true;
+}
+
+static void ayaneo_led_mc_verify_cache(void)
+{
+        if (ayaneo_ec_ram_supported()) {
+                if (!ayaneo_led_mc_verify_mode(AYANEO_LED_MC_ADDR_L) ||
+                    !ayaneo_led_mc_verify_mode(AYANEO_LED_MC_ADDR_R))
+                        ayaneo_led_mc_enabled = false;
+
+                ayaneo_led_mc_verify_ring(AYANEO_LED_MC_ADDR_L);
+                ayaneo_led_mc_verify_ring(AYANEO_LED_MC_ADDR_R);
+                return;
+        }
+
+        ayaneo_led_mc_enabled = false;
+        ayaneo_led_mc_cache_drop();
+}
+
+/* Returns true if control of the LEDs survived suspend, in which case the
+ * cache now only holds what is still on the LEDs, and the enable sequence is
+ * sent again on the next frame unless the microcontroller still holds it.
+ */
+static bool ayaneo_led_mc_resume_verify(void)
+{
+        bool owned;
+
+        /* Control was handed back to the firmware on suspend */
+        if (suspend_mode == AYANEO_LED_SUSPEND_MODE_OEM)
+                return false;
+
+        ayaneo_ec_batch_begin();
+
+        owned = ayaneo_led_mc_owned();
+        if (owned)
+                ayaneo_led_mc_verify_cache();
+
+        ayaneo_ec_batch_end();
+
+        return owned;
+}
+
+/* Threaded writes:
+ *  The writer thread's job is to push updates to the physical LEDs as fast as
+ *  possible while allowing updates to the LED multi_intensity/brightness sysfs
+ *  attributes to return quickly.
+ *
+ *  During multi_intensity/brightness set, the target color is packed into the
+ *  single atomic word ayaneo_led_mc_update_color (red in the low byte) and
+ *  ayaneo_led_mc_update_gen is incremented by 1. Neither side takes a lock, so
+ *  LED triggers calling brightness_set at high rates from timer context never
+ *  contend with the writer.
+ *
+ *  The writer thread sleeps on ayaneo_led_mc_writer_wait until the update
+ *  generation moves, so an idle writer causes no wakeups at all. Anything that
+ *  posts work must call ayaneo_led_mc_writer_kick() after bumping the
+ *  generation.
+ *
+ *  When the writer thread wakes, it reads the current generation followed by
+ *  the color, after which the new color is pushed to the microcontroller and
+ *  the generation is recorded in ayaneo_led_mc_applied_gen. The barriers pair
+ *  so that the writer can never observe a new generation with a stale color;
+ *  it may observe a new color with an old generation, in which case the next
+ *  iteration simply applies the same color again. If the generation moved
+ *  during the writes then the following iteration will immediately begin
+ *  writing the new color to the microcontroller, otherwise it goes back to
+ *  sleep until it is kicked again.
+ *
+ *  The writer thread lives as long as the driver and is freezable. Kernel
+ *  threads are frozen before the suspend callback runs, either at the wait
+ *  between frames or at a cancellation point within one (see Preemptible
+ *  frames), so the EC is never mid write cycle when the suspend callback
+ *  touches it. Updates requested while frozen are not lost, the generation
+ *  moves and the writer applies the latest color once it is thawed after
+ *  resume.
+ *
+ *  Resume does not touch the EC either. It only sets
+ *  ayaneo_led_mc_resume_pending and queues a refresh, and the writer retakes
+ *  control of the LEDs and lets the MCU settle before applying that frame. The
+ *  system resume path never waits for the LEDs.
+ *
+ *  Probe works the same way: the writer is started with a pending resume and
+ *  takes control of the LEDs for the first time, so the boot path never waits
+ *  for the EC.
+ */
+static atomic_t ayaneo_led_mc_update_color = ATOMIC_INIT(0);
+static atomic_t ayaneo_led_mc_update_gen = ATOMIC_INIT(0);
+static int ayaneo_led_mc_applied_gen;
+static atomic_t ayaneo_led_mc_resume_pending = ATOMIC_INIT(0);
+static u64 ayaneo_led_mc_resume_ns;
+static bool ayaneo_led_mc_controlled;  /* initial take-control done */
+
+static bool ayaneo_led_mc_update_pending(void)
+{
+        return atomic_read(&ayaneo_led_mc_update_gen) != ayaneo_led_mc_applied_gen;
+}
+
+static void ayaneo_led_mc_writer_kick(void)
+{
+        /* wq_has_sleeper() implies the barrier that orders the generation
+         * bump against the writer's condition check.
+         */
+        if (wq_has_sleeper(&ayaneo_led_mc_writer_wait))
+                wake_up(&ayaneo_led_mc_writer_wait);
+}
+
+static void ayaneo_led_mc_request_update(u32 packed_color)
+{
+        int gen;
+
+        atomic64_inc(&ayaneo_stats.frames_requested);
+        /* Only the first request the writer has not picked up yet is timed */
+        if (!atomic64_read(&ayaneo_stats.pending_since_ns))
+                atomic64_cmpxchg(&ayaneo_stats.pending_since_ns, 0, ktime_get_ns());
+
+        atomic_set(&ayaneo_led_mc_update_color, packed_color);
+        /* Fully ordered, so the color is visible before the new generation */
+        gen = atomic_inc_return(&ayaneo_led_mc_update_gen);
+        trace_ayaneo_led_request(packed_color, gen);
+
+        ayaneo_led_mc_writer_kick();
+}
+
+/* Re-apply the last requested color */
+static void ayaneo_led_mc_request_refresh(void)
+{
+        /* Order anything posted along with the refresh before the bump */
+        smp_mb__before_atomic();
+        atomic_inc(&ayaneo_led_mc_update_gen);
+
+        ayaneo_led_mc_writer_kick();
+}
+
+static void ayaneo_led_mc_scale_color(u8 *color, u8 max_value)
+{
+        for (int i = 0; i < 3; i++)
+        {
+                int c_color = (int)color[i] * (int)max_value / 255;
+
+                // prevents left-right discrepancy when brightness/color are low
+                if (c_color == 0 && color[i] > 0)
+                        c_color = 1;
+
+                color[i] = (u8)c_color;
+        }
+}
+
+static void ayaneo_led_mc_brightness_apply(u8 *color)
+{
+        u8 color_l[3]; /* Left joystick ring */
+        u8 color_r[3]; /* Right joystick ring */
+        u8 color_b[3]; /* AyaSpace Button (KUN Only) */
+
+        u8 zones[4] = {3, 6, 9, 12};
+
+        for (int i = 0; i < 3; i++)
+        {
+                color_l[i] = color[i];
+                color_r[i] = color[i];
+                color_b[i] = color[i];
+        }
+
+        ayaneo_led_mc_scale_color(color_l, 192);
+        ayaneo_led_mc_scale_color(color_r, 192);
+        ayaneo_led_mc_scale_color(color_b, 192);
+
+        ayaneo_ec_batch_begin();
+        ayaneo_ec_emu_frame_begin();
+
+        switch (model) {
+                case air:
+                case air_pro:
+                case air_1s:
+                        ayaneo_led_mc_legacy_on();
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case air_1s_limited:
+                        ayaneo_led_mc_scale_color(color_r, 204);
+                        ayaneo_led_mc_legacy_on();
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case geek:
+                case geek_1s:
+                case ayaneo_2:
+                case ayaneo_2s:
+                        ayaneo_led_mc_legacy_on();
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case air_plus_mendo:
+                        ayaneo_led_mc_scale_color(color_l, 64);
+                        ayaneo_led_mc_scale_color(color_r, 32);
+                        ayaneo_led_mc_legacy_on();
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_legacy_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case air_plus:
+                        ayaneo_led_mc_scale_color(color_l, 64);
+                        ayaneo_led_mc_scale_color(color_r, 32);
+                        ayaneo_led_mc_on();
+                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case slide:
+                        ayaneo_led_mc_on();
+                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_LEFT, color_l, zones);
+                        ayaneo_led_mc_intensity(AYANEO_LED_GROUP_RIGHT, color_r, zones);
+                        break;
+                case kun:
+                        ayaneo_led_mc_legacy_on();
+                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_LEFT, color_l);
+                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_RIGHT, color_r);
+                        ayaneo_led_mc_legacy_intensity_kun(AYANEO_LED_GROUP_BUTTON, color_b);
+                        break;
+                default:
+                        break;
+        }
+
+        ayaneo_ec_emu_frame_end();
+        ayaneo_ec_batch_end();
+}
+
+/* Take control after probe, or retake it after resume, on behalf of
+ * ayaneo_platform_probe and ayaneo_platform_resume.
+ */
+static void ayaneo_led_mc_resume_restore(void)
+{
+        /* The firmware owned the EC ram window during suspend */
+        ayaneo_ec_ram_addr_high = -1;
+
+        if (!ayaneo_led_mc_controlled) {
+                ayaneo_led_mc_take_control();
+
+                if (ec_calibrate && !ayaneo_led_mc_frame_aborted)
+                        ayaneo_ec_calibrate();
+
+                WRITE_ONCE(ayaneo_led_mc_controlled, !ayaneo_led_mc_frame_aborted);
+                return;
+        }
+
+        if (ayaneo_led_mc_resume_verify())
+                return;
+
+        ayaneo_led_mc_take_control();
+
+        /* Allow the MCU to sync with the new state */
+        ayaneo_led_mc_frame_sleep(ayaneo_ec_timing.resume_ms);
+}
+
+int ayaneo_led_mc_writer(void *pv);
+int ayaneo_led_mc_writer(void *pv)
+{
+        int gen;
+        u32 packed;
+        u8 color[3];
+        u64 requested_ns;
+        u64 start;
+        u64 now;
+        bool resumed;
+
+        pr_info("Writer thread started.\n");
+
+        set_freezable();
+
+        while (!kthread_should_stop())
+        {
+                wait_event_freezable(ayaneo_led_mc_writer_wait,
+                                     ayaneo_led_mc_update_pending() ||
+                                     kthread_should_stop());
+
+                if (!ayaneo_led_mc_update_pending())
+                        continue;
+
+                ayaneo_led_mc_frame_begin();
+
+                resumed = atomic_xchg(&ayaneo_led_mc_resume_pending, 0);
+                if (resumed)
+                        ayaneo_led_mc_resume_restore();
+
+                requested_ns = atomic64_xchg(&ayaneo_stats.pending_since_ns, 0);
+                gen = atomic_read(&ayaneo_led_mc_update_gen);
+                smp_rmb();
+                packed = atomic_read(&ayaneo_led_mc_update_color);
+
+                for (int i = 0; i < 3; i++)
+                        color[i] = (packed >> (8 * i)) & 0xff;
+
+                trace_ayaneo_led_frame_start(packed, gen);
+                start = ktime_get_ns();
+                ayaneo_led_mc_brightness_apply(color);
+                now = ktime_get_ns();
+
+                if (ayaneo_led_mc_frame_aborted) {
+                        /* See Preemptible frames */
+                        atomic64_inc(&ayaneo_stats.frames_aborted);
+                        if (requested_ns)
+                                atomic64_cmpxchg(&ayaneo_stats.pending_since_ns, 0,
+                                                 requested_ns);
+                        if (resumed)
+                                atomic_set(&ayaneo_led_mc_resume_pending, 1);
+                        ayaneo_led_mc_enabled = false;
+
+                        try_to_freeze();
+                        continue;
+                }
+                ayaneo_led_mc_frame_preempt_point();
+
+                atomic64_inc(&ayaneo_stats.frames_committed);
+                if (gen - ayaneo_led_mc_applied_gen > 1)
+                        atomic64_add(gen - ayaneo_led_mc_applied_gen - 1,
+                                     &ayaneo_stats.frames_coalesced);
+                ayaneo_stats_hist_add(&ayaneo_stats.frame_duration, now - start);
+                if (requested_ns)
+                        ayaneo_stats_hist_add(&ayaneo_stats.request_latency,
+                                              now - requested_ns);
+                if (resumed)
+                        atomic64_set(&ayaneo_stats.resume_restore_ns,
+                                     now - ayaneo_led_mc_resume_ns);
+
+                ayaneo_led_mc_applied_gen = gen;
+                trace_ayaneo_led_frame_end(gen);
+        }
+
+        pr_info("Writer thread stopped.\n");
+        return 0;
+}
+
+/* RGB LED Logic */
+static void ayaneo_led_mc_brightness_set(struct led_classdev *led_cdev,
+                                      enum led_brightness brightness)
+{
+        struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
+        u32 packed = 0;
+        int val;
+        int i;
+        struct mc_subled s_led;
+
+        if (brightness < 0 || brightness > 255)
+                return;
+
+        led_cdev->brightness = brightness;
+
+        for (i = 0; i < mc_cdev->num_colors; i++) {
+                s_led = mc_cdev->subled_info[i];
+                if (s_led.intensity < 0 || s_led.intensity > 255)
+                        return;
+                val = brightness * s_led.intensity / led_cdev->max_brightness;
+                packed |= (u32)val << (8 * s_led.channel);
+        }
+
+        ayaneo_led_mc_request_update(packed);
+};
+
+static enum led_brightness ayaneo_led_mc_brightness_get(struct led_classdev *led_cdev)
+{
+        return led_cdev->brightness;
+};
+
+/* Suspend Mode
+# Multiple modes of operation are supported during suspend:
+#
+# OEM:  Retains the default behavior of the device by returning control to the
+#       microcontroller. On most devices the LEDs will flash periodically, and
+#       will turn red when charging.
+# Off:  The LEDs are turned off during suspend, and control of the LEDs is
+#       retained by the driver. On most devices, charging will not turn on the
+#       LEDs. During resume, the last color set is restored.
+# Keep: The color currently set on the LEDs remains unchanged, and control of
+#       the LEDs is retained by the driver. On most devices, charging will not
+#       change the color of the LEDs.
+*/
+static ssize_t suspend_mode_show(struct device *dev, struct device_attribute *attr,
+                                 char *buf)
+{
+        bool active;
+        ssize_t count = 0;
+        int i;
+
+        for (i = 0; i <  ARRAY_SIZE(AYANEO_LED_SUSPEND_MODE_TEXT); i++) {
+                active = i == suspend_mode;
+
+                if (active) {
+                        count += sysfs_emit_at(buf, count, "[%s] ",
+                                   AYANEO_LED_SUSPEND_MODE_TEXT[i]);
+                }
+                else {
+                        count += sysfs_emit_at(buf, count, "%s ",
+                                   AYANEO_LED_SUSPEND_MODE_TEXT[i]);
+                }
+        }
+
+        if (count)
+                buf[count - 1] = '\n';
+
+        return count;
+}
+
+static ssize_t suspend_mode_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+        int res = sysfs_match_string(AYANEO_LED_SUSPEND_MODE_TEXT, buf);
+
+        if (res < 0)
+                return -EINVAL;
+
+        suspend_mode = res;
+
+        return count;
+}
+
+static DEVICE_ATTR_RW(suspend_mode);
+
+static struct attribute *ayaneo_led_mc_attrs[] = {
+        NULL,
+};
+
+static struct attribute_group ayaneo_led_mc_group = {
+      .attrs = ayaneo_led_mc_attrs,
+};
+
+static void suspend_mode_register_attr(void)
+{
+        switch (model) {
+                case air:
+                case air_1s:
+                case air_1s_limited:
+                case air_pro:
+                case air_plus_mendo:
+                case geek:
+                case geek_1s:
+                case ayaneo_2:
+                case ayaneo_2s:
+                case kun:
+                case air_plus:
+                case slide:
+                        ayaneo_led_mc_attrs[0] = &dev_attr_suspend_mode.attr;
+                        break;
+                default:
+                        break;
+        }
+}
+
+struct mc_subled ayaneo_led_mc_subled_info[] = {
+        {
+                .color_index = LED_COLOR_ID_RED,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = 0,
+        },
+        {
+                .color_index = LED_COLOR_ID_GREEN,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = 1,
+        },
+        {
+                .color_index = LED_COLOR_ID_BLUE,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = 2,
+        },
+};
+
+struct led_classdev_mc ayaneo_led_mc = {
+        .led_cdev = {
+                .name = "ayaneo:rgb:joystick_rings",
+                .brightness = 0,
+                .max_brightness = 255,
+                .brightness_set = ayaneo_led_mc_brightness_set,
+                .brightness_get = ayaneo_led_mc_brightness_get,
+        },
+        .num_colors = ARRAY_SIZE(ayaneo_led_mc_subled_info),
+        .subled_info = ayaneo_led_mc_subled_info,
+};
+
+/* Debugfs
+ *  Diagnostics live in /sys/kernel/debug/ayaneo-platform/.
+ */
+static struct dentry *ayaneo_debugfs_dir;
+
+static int ec_ram_show(struct seq_file *m, void *unused)
+{
+        u8 buf[AYANEO_EC_RAM_WINDOW_SIZE];
+        int ret;
+
+        ret = ayaneo_ec_ram_snapshot(buf);
+        if (ret)
+                return ret;
+
+        seq_hex_dump(m, "", DUMP_PREFIX_OFFSET, 16, 1, buf, sizeof(buf), false);
+
+        return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ec_ram);
+
+static int emu_state_show(struct seq_file *m, void *unused)
+{
+        ayaneo_ec_batch_begin();
+
+        seq_puts(m, "ec ram:\n");
+        seq_hex_dump(m, "", DUMP_PREFIX_OFFSET, 16, 1, ayaneo_ec_emu.ram,
+                     sizeof(ayaneo_ec_emu.ram), false);
+
+        seq_puts(m, "legacy leds:\n");
+        for (int group = AYANEO_LED_GROUP_LEFT; group <= AYANEO_LED_GROUP_BUTTON; group++) {
+                seq_printf(m, "%d: ", group);
+                seq_hex_dump(m, "", DUMP_PREFIX_NONE, AYANEO_EC_EMU_LEGACY_POS, 1,
+                             ayaneo_ec_emu.legacy_leds[group], AYANEO_EC_EMU_LEGACY_POS,
+                             false);
+        }
+
+        ayaneo_ec_batch_end();
+
+        return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(emu_state);
+
+static int emu_trace_show(struct seq_file *m, void *unused)
+{
+        struct ayaneo_ec_emu_event *event;
+
+        ayaneo_ec_batch_begin();
+
+        for (unsigned int i = 0; i < ayaneo_ec_emu_trace.len; i++) {
+                event = &ayaneo_ec_emu_trace.events[i];
+                if (event->op == AYANEO_EC_EMU_DELAY)
+                        seq_printf(m, "%s %u\n", AYANEO_EC_EMU_OP_TEXT[event->op],
+                                   event->value);
+                else
+                        seq_printf(m, "%s %02x %02x\n", AYANEO_EC_EMU_OP_TEXT[event->op],
+                                   event->addr, event->value);
+        }
+
+        if (ayaneo_ec_emu_trace.dropped)
+                seq_printf(m, "dropped %llu\n", ayaneo_ec_emu_trace.dropped);
+
+        ayaneo_ec_batch_end();
+
+        return 0;
+}
+
+static int emu_trace_open(struct inode *inode, struct file *file)
+{
+        return single_open(file, emu_trace_show, NULL);
+}
+
+/* Any write clears the trace */
+static ssize_t emu_trace_write(struct file *file, const char __user *buf,
+                               size_t count, loff_t *ppos)
+{
+        ayaneo_ec_batch_begin();
+        ayaneo_ec_emu_trace.len = 0;
+        ayaneo_ec_emu_trace.dropped = 0;
+        ayaneo_ec_batch_end();
+
+        return count;
+}
+
+static const struct file_operations emu_trace_fops = {
+        .owner = THIS_MODULE,
+        .open = emu_trace_open,
+        .read = seq_read,
+        .write = emu_trace_write,
+        .llseek = seq_lseek,
+        .release = single_release,
+};
+
+static void ayaneo_platform_debugfs_emu_init(void)
+{
+        struct dentry *dir = debugfs_create_dir("emulator", ayaneo_debugfs_dir);
+
+        debugfs_create_u64("port_writes", 0444, dir, &ayaneo_ec_emu.port_writes);
+        debugfs_create_u64("port_reads", 0444, dir, &ayaneo_ec_emu.port_reads);
+        debugfs_create_u64("ec_writes", 0444, dir, &ayaneo_ec_emu.ec_writes);
+        debugfs_create_u64("ec_reads", 0444, dir, &ayaneo_ec_emu.ec_reads);
+        debugfs_create_u64("latches", 0444, dir, &ayaneo_ec_emu.latches);
+        debugfs_create_u64("legacy_commits", 0444, dir, &ayaneo_ec_emu.legacy_commits);
+        debugfs_create_u64("delay_us", 0444, dir, &ayaneo_ec_emu.delay_us);
+        debugfs_create_u64("busy_ns", 0444, dir, &ayaneo_ec_emu.busy_ns);
+        debugfs_create_u64("frames", 0444, dir, &ayaneo_ec_emu.frames);
+        debugfs_create_u64("frame_writes", 0444, dir, &ayaneo_ec_emu.frame_writes);
+        debugfs_create_u64("frame_delay_us", 0444, dir, &ayaneo_ec_emu.frame_delay_us);
+        debugfs_create_u64("frame_max_writes", 0644, dir, &ayaneo_ec_emu.frame_max_writes);
+        debugfs_create_u64("frame_max_delay_us", 0644, dir, &ayaneo_ec_emu.frame_max_delay_us);
+        debugfs_create_file("state", 0400, dir, NULL, &emu_state_fops);
+        debugfs_create_bool("trace_enable", 0644, dir, &ayaneo_ec_emu_trace.enabled);
+        debugfs_create_file("trace", 0600, dir, NULL, &emu_trace_fops);
+}
+
+static void stats_show_hist(struct seq_file *m, const char *name,
+                            struct ayaneo_stats_hist *hist)
+{
+        u64 count;
+
+        seq_printf(m, "%s:\n", name);
+
+        for (int i = 0; i < AYANEO_STATS_HIST_BUCKETS; i++) {
+                count = atomic64_read(&hist->buckets[i]);
+                if (count)
+                        seq_printf(m, "  >= %10llu ns: %llu\n", i ? 1ULL << i : 0, count);
+        }
+}
+
+static int stats_show(struct seq_file *m, void *unused)
+{
+        seq_printf(m, "frames_requested: %lld\n",
+                   atomic64_read(&ayaneo_stats.frames_requested));
+        seq_printf(m, "frames_committed: %lld\n",
+                   atomic64_read(&ayaneo_stats.frames_committed));
+        seq_printf(m, "frames_coalesced: %lld\n",
+                   atomic64_read(&ayaneo_stats.frames_coalesced));
+        seq_printf(m, "frames_aborted: %lld\n",
+                   atomic64_read(&ayaneo_stats.frames_aborted));
+        seq_printf(m, "ec_writes: %lld\n", atomic64_read(&ayaneo_stats.ec_writes));
+        seq_printf(m, "ec_write_failures: %lld\n",
+                   atomic64_read(&ayaneo_stats.ec_write_failures));
+        seq_printf(m, "ec_lock_timeouts: %llu\n", ayaneo_ec_lock_stats.timeouts);
+        seq_printf(m, "resume_callback_ns: %lld\n",
+                   atomic64_read(&ayaneo_stats.resume_callback_ns));
+        seq_printf(m, "resume_restore_ns: %lld\n",
+                   atomic64_read(&ayaneo_stats.resume_restore_ns));
+        seq_printf(m, "suspend_callback_ns: %lld\n",
+                   atomic64_read(&ayaneo_stats.suspend_callback_ns));
+
+        stats_show_hist(m, "request_latency", &ayaneo_stats.request_latency);
+        stats_show_hist(m, "frame_duration", &ayaneo_stats.frame_duration);
+        stats_show_hist(m, "lock_wait", &ayaneo_stats.lock_wait);
+        stats_show_hist(m, "delay_wall", &ayaneo_stats.delay_wall);
+        stats_show_hist(m, "preempt_step", &ayaneo_stats.preempt_step);
+
+        return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/* Self-benchmark
+ *  Writing a frame count to the bench file runs that many synthetic frames
+ *  through ayaneo_led_mc_brightness_apply on whatever EC is active, the
+ *  emulated one included, and the last requested color is restored
+ *  afterwards. Each frame takes the batch on its own, so the writer thread,
+ *  suspend and the freezer are never held off for more than one frame; EC
+ *  writes made by the writer thread during a run are counted in the result.
+ *  The run stops early with -EINTR on a fatal signal or when freezing.
+ *  Reading the file shows the result of the last completed run.
+ */
+#define AYANEO_BENCH_MAX_FRAMES       10000
+
+static DEFINE_MUTEX(ayaneo_bench_lock);
+
+static struct {
+        unsigned int frames;
+        u64 min_ns;
+        u64 avg_ns;
+        u64 p99_ns;
+        u64 max_ns;
+        u64 ec_writes;
+        u64 lock_wait_ns;
+} ayaneo_bench_result;
+
+static int ayaneo_bench_cmp(const void *a, const void *b)
+{
+        u64 x = *(const u64 *)a;
+        u64 y = *(const u64 *)b;
+
+        return x < y ? -1 : x > y;
+}
+
+static int ayaneo_bench_run(unsigned int frames)
+{
+        u64 ec_writes;
+        u64 lock_wait_ns;
+        u64 total = 0;
+        u64 start;
+        u64 *ns;
+        u8 color[3];
+        int ret = 0;
+
+        ns = kvmalloc_array(frames, sizeof(*ns), GFP_KERNEL);
+        if (!ns)
+                return -ENOMEM;
+
+        /* Whatever is on the LEDs now must not absorb the first frame */
+        ayaneo_led_mc_cache_drop();
+
+        ec_writes = atomic64_read(&ayaneo_stats.ec_writes);
+        lock_wait_ns = READ_ONCE(ayaneo_ec_lock_stats.wait_ns);
+
+        for (unsigned int i = 0; i < frames; i++) {
+                if (fatal_signal_pending(current) || freezing(current)) {
+                        ret = -EINTR;
+                        break;
+                }
+
+                /* Alternate between full and zero on each channel, so every
+                 * subpixel changes whatever the model scales it to and no
+                 * frame is absorbed by the cache.
+                 */
+                color[0] = i & 1 ? 0 : 255;
+                color[1] = i & 1 ? 255 : 0;
+                color[2] = i & 1 ? 0 : 255;
+
+                start = ktime_get_ns();
+                ayaneo_led_mc_brightness_apply(color);
+                ns[i] = ktime_get_ns() - start;
+                total += ns[i];
+        }
+
+        if (ret)
+                goto out;
+
+        ayaneo_bench_result.ec_writes = atomic64_read(&ayaneo_stats.ec_writes) - ec_writes;
+        ayaneo_bench_result.lock_wait_ns = READ_ONCE(ayaneo_ec_lock_stats.wait_ns) - lock_wait_ns;
+
+        sort(ns, frames, sizeof(*ns), ayaneo_bench_cmp, NULL);
+
+        ayaneo_bench_result.frames = frames;
+        ayaneo_bench_result.min_ns = ns[0];
+        ayaneo_bench_result.avg_ns = div_u64(total, frames);
+        ayaneo_bench_result.p99_ns = ns[(frames - 1) * 99 / 100];
+        ayaneo_bench_result.max_ns = ns[frames - 1];
+
+out:
+        kvfree(ns);
+
+        /* Put the color the user asked for back */
+        ayaneo_led_mc_request_refresh();
+
+        return ret;
+}
+
+static int bench_show(struct seq_file *m, void *unused)
+{
+        mutex_lock(&ayaneo_bench_lock);
+
+        seq_printf(m, "ec: %s\n", ayaneo_ec->name);
+        seq_printf(m, "frames: %u\n", ayaneo_bench_result.frames);
+
+        if (ayaneo_bench_result.frames) {
+                seq_printf(m, "frame_min_ns: %llu\n", ayaneo_bench_result.min_ns);
+                seq_printf(m, "frame_avg_ns: %llu\n", ayaneo_bench_result.avg_ns);
+                seq_printf(m, "frame_p99_ns: %llu\n", ayaneo_bench_result.p99_ns);
+                seq_printf(m, "frame_max_ns: %llu\n", ayaneo_bench_result.max_ns);
+                seq_printf(m, "ec_writes_per_frame: %llu\n",
+                           div_u64(ayaneo_bench_result.ec_writes, ayaneo_bench_result.frames));
+                seq_printf(m, "lock_wait_ns_per_frame: %llu\n",
+                           div_u64(ayaneo_bench_result.lock_wait_ns, ayaneo_bench_result.frames));
+        }
+
+        mutex_unlock(&ayaneo_bench_lock);
+
+        return 0;
+}
+
+static int bench_open(struct inode *inode, struct file *file)
+{
+        return single_open(file, bench_show, NULL);
+}
+
+static ssize_t bench_write(struct file *file, const char __user *buf,
+                           size_t count, loff_t *ppos)
+{
+        unsigned int frames;
+        int ret;
+
+        ret = kstrtouint_from_user(buf, count, 0, &frames);
+        if (ret)
+                return ret;
+
+        if (!frames || frames > AYANEO_BENCH_MAX_FRAMES)
+                return -EINVAL;
+
+        /* Not before the writer has taken control, see Threaded writes */
+        if (!READ_ONCE(ayaneo_led_mc_controlled))
+                return -EAGAIN;
+
+        mutex_lock(&ayaneo_bench_lock);
+        ret = ayaneo_bench_run(frames);
+        mutex_unlock(&ayaneo_bench_lock);
+
+        return ret ? ret : count;
+}
+
+static const struct file_operations bench_fops = {
+        .owner = THIS_MODULE,
+        .open = bench_open,
+        .read = seq_read,
+        .write = bench_write,
+        .llseek = seq_lseek,
+        .release = single_release,
+};
+
+/* Request benchmark
+ *  Writing a call count to the bench_request file starts bench_request_threads
+ *  threads at once, each posting the requested color that many times through
+ *  ayaneo_led_mc_request_update, the fast path of brightness_set, while the
+ *  writer thread keeps consuming the updates. Posting the color that is
+ *  already requested leaves the LEDs alone, and as the cache absorbs the
+ *  frames the EC too; only frames_requested moves. Reading the file shows the
+ *  cost per call averaged over all threads and of the slowest thread.
+ */
+#define AYANEO_BENCH_REQUEST_MAX_THREADS    64
+#define AYANEO_BENCH_REQUEST_MAX_CALLS      1000000
+
+static u32 ayaneo_bench_request_threads = 4;
+
+struct ayaneo_bench_request_thread {
+        struct completion *start;
+        struct completion done;
+        unsigned int calls;
+        u32 packed;
+        u64 ns;
+};
 
-        while (!kthread_should_stop())
-        {
-                read_lock(&ayaneo_led_mc_update_lock);
-                count = ayaneo_led_mc_update_required;
+static struct {
+        unsigned int threads;
+        unsigned int calls;
+        u64 avg_ns;
+        u64 max_ns;
+} ayaneo_bench_request_result;
 
-                if (count)
-                {
-                        color[0] = ayaneo_led_mc_update_color[0];
-                        color[1] = ayaneo_led_mc_update_color[1];
-                        color[2] = ayaneo_led_mc_update_color[2];
-                }
-                read_unlock(&ayaneo_led_mc_update_lock);
+static int ayaneo_bench_request_thread(void *data)
+{
+        struct ayaneo_bench_request_thread *t = data;
+        u64 start;
 
-                if (count)
-                {
-                        ayaneo_led_mc_brightness_apply(color);
+        wait_for_completion(t->start);
 
-                        write_lock(&ayaneo_led_mc_update_lock);
-                        ayaneo_led_mc_update_required -= count;
-                        write_unlock(&ayaneo_led_mc_update_lock);
-                }
-                else
-                        usleep_range(AYANEO_LED_WRITER_DELAY_RANGE_US);
-        }
+        start = ktime_get_ns();
+        for (unsigned int i = 0; i < t->calls; i++)
+                ayaneo_led_mc_request_update(t->packed);
+        t->ns = ktime_get_ns() - start;
 
-        pr_info("Writer thread stopped.\n");
-        return 0;
+        /* Never return into module text that may be unloaded meanwhile */
+        kthread_complete_and_exit(&t->done, 0);
 }
 
-/* RGB LED Logic */
-static void ayaneo_led_mc_brightness_set(struct led_classdev *led_cdev,
-                                      enum led_brightness brightness)
+static int ayaneo_bench_request_run(unsigned int threads, unsigned int calls)
 {
-        struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
-        int val;
-        int i;
-        struct mc_subled s_led;
+        struct ayaneo_bench_request_thread *t;
+        struct task_struct *task;
+        DECLARE_COMPLETION_ONSTACK(start);
+        unsigned int started;
+        u64 total = 0;
+        u64 slowest = 0;
+        u32 packed;
+        int ret = 0;
+
+        t = kcalloc(threads, sizeof(*t), GFP_KERNEL);
+        if (!t)
+                return -ENOMEM;
+
+        packed = atomic_read(&ayaneo_led_mc_update_color);
+
+        for (started = 0; started < threads; started++) {
+                t[started].start = &start;
+                init_completion(&t[started].done);
+                t[started].calls = calls;
+                t[started].packed = packed;
+
+                task = kthread_run(ayaneo_bench_request_thread, &t[started],
+                                   "ayaneo-platform bench/%u", started);
+                if (IS_ERR(task)) {
+                        ret = PTR_ERR(task);
+                        break;
+                }
+        }
 
-        if (brightness < 0 || brightness > 255)
-                return;
+        /* Release them together, so the calls really run concurrently */
+        complete_all(&start);
 
-        led_cdev->brightness = brightness;
+        for (unsigned int i = 0; i < started; i++) {
+                wait_for_completion(&t[i].done);
+                total += t[i].ns;
+                slowest = max(slowest, t[i].ns);
+        }
 
-        write_lock(&ayaneo_led_mc_update_lock);
-        for (i = 0; i < mc_cdev->num_colors; i++) {
-                s_led = mc_cdev->subled_info[i];
-                if (s_led.intensity < 0 || s_led.intensity > 255)
-                        return;
-                val = brightness * s_led.intensity / led_cdev->max_brightness;
-                ayaneo_led_mc_update_color[s_led.channel] = val;
+        if (!ret) {
+                ayaneo_bench_request_result.threads = threads;
+                ayaneo_bench_request_result.calls = calls;
+                ayaneo_bench_request_result.avg_ns = div64_u64(total, (u64)threads * calls);
+                ayaneo_bench_request_result.max_ns = div_u64(slowest, calls);
         }
-        ayaneo_led_mc_update_required++;
-        write_unlock(&ayaneo_led_mc_update_lock);
-};
 
-static enum led_brightness ayaneo_led_mc_brightness_get(struct led_classdev *led_cdev)
-{
-        return led_cdev->brightness;
-};
+        kfree(t);
 
-/* Suspend Mode
-# Multiple modes of operation are supported during suspend:
-#
-# OEM:  Retains the default behavior of the device by returning control to the
-#       microcontroller. On most devices the LEDs will flash periodically, and
-#       will turn red when charging.
-# Off:  The LEDs are turned off during suspend, and control of the LEDs is
-#       retained by the driver. On most devices, charging will not turn on the
-#       LEDs. During resume, the last color set is restored.
-# Keep: The color currently set on the LEDs remains unchanged, and control of
-#       the LEDs is retained by the driver. On most devices, charging will not
-#       change the color of the LEDs.
-*/
-static ssize_t suspend_mode_show(struct device *dev, struct device_attribute *attr,
-                                 char *buf)
+        /* Post the color again in case the user changed it during the run */
+        ayaneo_led_mc_brightness_set(&ayaneo_led_mc.led_cdev, ayaneo_led_mc.led_cdev.brightness);
+
+        return ret;
+}
+
+static int bench_request_show(struct seq_file *m, void *unused)
 {
-        bool active;
-        ssize_t count = 0;
-        int i;
+        mutex_lock(&ayaneo_bench_lock);
 
-        for (i = 0; i <  ARRAY_SIZE(AYANEO_LED_SUSPEND_MODE_TEXT); i++) {
-                active = i == suspend_mode;
+        seq_printf(m, "threads: %u\n", ayaneo_bench_request_result.threads);
+        seq_printf(m, "calls_per_thread: %u\n", ayaneo_bench_request_result.calls);
 
-                if (active) {
-                        count += sysfs_emit_at(buf, count, "[%s] ",
-                                   AYANEO_LED_SUSPEND_MODE_TEXT[i]);
-                }
-                else {
-                        count += sysfs_emit_at(buf, count, "%s ",
-                                   AYANEO_LED_SUSPEND_MODE_TEXT[i]);
-                }
+        if (ayaneo_bench_request_result.calls) {
+                seq_printf(m, "call_avg_ns: %llu\n", ayaneo_bench_request_result.avg_ns);
+                seq_printf(m, "call_max_thread_ns: %llu\n", ayaneo_bench_request_result.max_ns);
         }
 
-        if (count)
-                buf[count - 1] = '\n';
+        mutex_unlock(&ayaneo_bench_lock);
 
-        return count;
+        return 0;
 }
 
-static ssize_t suspend_mode_store(struct device *dev, struct device_attribute *attr,
-                               const char *buf, size_t count)
+static int bench_request_open(struct inode *inode, struct file *file)
 {
-        int res = sysfs_match_string(AYANEO_LED_SUSPEND_MODE_TEXT, buf);
+        return single_open(file, bench_request_show, NULL);
+}
 
-        if (res < 0)
+static ssize_t bench_request_write(struct file *file, const char __user *buf,
+                                   size_t count, loff_t *ppos)
+{
+        unsigned int threads = READ_ONCE(ayaneo_bench_request_threads);
+        unsigned int calls;
+        int ret;
+
+        ret = kstrtouint_from_user(buf, count, 0, &calls);
+        if (ret)
+                return ret;
+
+        if (!calls || calls > AYANEO_BENCH_REQUEST_MAX_CALLS ||
+            !threads || threads > AYANEO_BENCH_REQUEST_MAX_THREADS)
                 return -EINVAL;
 
-        suspend_mode = res;
+        mutex_lock(&ayaneo_bench_lock);
+        ret = ayaneo_bench_request_run(threads, calls);
+        mutex_unlock(&ayaneo_bench_lock);
 
-        return count;
+        return ret ? ret : count;
 }
 
-static DEVICE_ATTR_RW(suspend_mode);
-
-static struct attribute *ayaneo_led_mc_attrs[] = {
-        NULL,
+static const struct file_operations bench_request_fops = {
+        .owner = THIS_MODULE,
+        .open = bench_request_open,
+        .read = seq_read,
+        .write = bench_request_write,
+        .llseek = seq_lseek,
+        .release = single_release,
 };
 
-static struct attribute_group ayaneo_led_mc_group = {
-      .attrs = ayaneo_led_mc_attrs,
+/* Any write clears every statistic, for A/B measurements */
+static ssize_t reset_write(struct file *file, const char __user *buf,
+                           size_t count, loff_t *ppos)
+{
+        atomic64_set(&ayaneo_stats.frames_requested, 0);
+        atomic64_set(&ayaneo_stats.frames_committed, 0);
+        atomic64_set(&ayaneo_stats.frames_coalesced, 0);
+        atomic64_set(&ayaneo_stats.frames_aborted, 0);
+        atomic64_set(&ayaneo_stats.ec_writes, 0);
+        atomic64_set(&ayaneo_stats.ec_write_failures, 0);
+        atomic64_set(&ayaneo_stats.resume_callback_ns, 0);
+        atomic64_set(&ayaneo_stats.resume_restore_ns, 0);
+        atomic64_set(&ayaneo_stats.suspend_callback_ns, 0);
+        ayaneo_stats_hist_reset(&ayaneo_stats.request_latency);
+        ayaneo_stats_hist_reset(&ayaneo_stats.frame_duration);
+        ayaneo_stats_hist_reset(&ayaneo_stats.lock_wait);
+        ayaneo_stats_hist_reset(&ayaneo_stats.delay_wall);
+        ayaneo_stats_hist_reset(&ayaneo_stats.preempt_step);
+
+        ayaneo_ec_batch_begin();
+        memset(&ayaneo_ec_lock_stats, 0, sizeof(ayaneo_ec_lock_stats));
+        memset(&ayaneo_ec_ram_stats, 0, sizeof(ayaneo_ec_ram_stats));
+        ayaneo_ec_batch_end();
+
+        return count;
+}
+
+static const struct file_operations reset_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .write = reset_write,
+        .llseek = noop_llseek,
 };
 
-static void suspend_mode_register_attr(void)
+static int timing_show(struct seq_file *m, void *unused)
 {
-        switch (model) {
-                case air:
-                case air_1s:
-                case air_1s_limited:
-                case air_pro:
-                case air_plus_mendo:
-                case geek:
-                case geek_1s:
-                case ayaneo_2:
-                case ayaneo_2s:
-                case kun:
-                case air_plus:
-                case slide:
-                        ayaneo_led_mc_attrs[0] = &dev_attr_suspend_mode.attr;
-                        break;
-                default:
-                        break;
-        }
+        seq_printf(m, "latch_us: %u\n", ayaneo_ec_timing.latch_us);
+        seq_printf(m, "write_cycle_us: %u\n", ayaneo_ec_timing.write_cycle_us);
+        seq_printf(m, "resume_ms: %u\n", ayaneo_ec_timing.resume_ms);
+        seq_printf(m, "calibrated: %d\n", ayaneo_ec_timing.calibrated);
+
+        return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(timing);
 
-struct mc_subled ayaneo_led_mc_subled_info[] = {
-        {
-                .color_index = LED_COLOR_ID_RED,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = 0,
-        },
-        {
-                .color_index = LED_COLOR_ID_GREEN,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = 1,
-        },
-        {
-                .color_index = LED_COLOR_ID_BLUE,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = 2,
-        },
-};
+/* Any write runs the timing calibration */
+static ssize_t calibrate_write(struct file *file, const char __user *buf,
+                               size_t count, loff_t *ppos)
+{
+        int ret;
 
-struct led_classdev_mc ayaneo_led_mc = {
-        .led_cdev = {
-                .name = "ayaneo:rgb:joystick_rings",
-                .brightness = 0,
-                .max_brightness = 255,
-                .brightness_set = ayaneo_led_mc_brightness_set,
-                .brightness_get = ayaneo_led_mc_brightness_get,
-        },
-        .num_colors = ARRAY_SIZE(ayaneo_led_mc_subled_info),
-        .subled_info = ayaneo_led_mc_subled_info,
+        /* Not before the writer has taken control, see Threaded writes */
+        if (!READ_ONCE(ayaneo_led_mc_controlled))
+                return -EAGAIN;
+
+        ret = ayaneo_ec_calibrate();
+
+        /* Put the color the test subpixel replaced back */
+        ayaneo_led_mc_request_refresh();
+
+        return ret ? ret : count;
+}
+
+static const struct file_operations calibrate_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .write = calibrate_write,
+        .llseek = noop_llseek,
 };
 
+static void ayaneo_platform_debugfs_init(void)
+{
+        ayaneo_debugfs_dir = debugfs_create_dir("ayaneo-platform", NULL);
+
+        debugfs_create_u64("ec_lock_acquisitions", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_lock_stats.acquisitions);
+        debugfs_create_u64("ec_lock_timeouts", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_lock_stats.timeouts);
+        debugfs_create_u64("ec_lock_wait_ns", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_lock_stats.wait_ns);
+        debugfs_create_u64("ec_ram_byte_writes", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_ram_stats.writes[AYANEO_EC_IO_BYTE]);
+        debugfs_create_u64("ec_ram_byte_write_ns", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_ram_stats.write_ns[AYANEO_EC_IO_BYTE]);
+        debugfs_create_u64("ec_ram_word_writes", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_ram_stats.writes[AYANEO_EC_IO_WORD]);
+        debugfs_create_u64("ec_ram_word_write_ns", 0444, ayaneo_debugfs_dir,
+                           &ayaneo_ec_ram_stats.write_ns[AYANEO_EC_IO_WORD]);
+
+        debugfs_create_file("stats", 0444, ayaneo_debugfs_dir, NULL, &stats_fops);
+        debugfs_create_file("reset", 0200, ayaneo_debugfs_dir, NULL, &reset_fops);
+        debugfs_create_file("bench", 0600, ayaneo_debugfs_dir, NULL, &bench_fops);
+        debugfs_create_file("bench_request", 0600, ayaneo_debugfs_dir, NULL,
+                            &bench_request_fops);
+        debugfs_create_u32("bench_request_threads", 0600, ayaneo_debugfs_dir,
+                           &ayaneo_bench_request_threads);
+        debugfs_create_file("timing", 0444, ayaneo_debugfs_dir, NULL, &timing_fops);
+        debugfs_create_file("calibrate", 0200, ayaneo_debugfs_dir, NULL, &calibrate_fops);
+
+        if (ayaneo_ec_ram_supported())
+                debugfs_create_file("ec_ram", 0400, ayaneo_debugfs_dir, NULL,
+                                    &ec_ram_fops);
+
+        if (ec_emulate)
+                ayaneo_platform_debugfs_emu_init();
+}
+
+/* Taking control back and restoring the color is left to the writer thread,
+ * see Threaded writes.
+ */
 static int ayaneo_platform_resume(struct platform_device *pdev)
 {
-        ayaneo_led_mc_take_control();
+        ayaneo_led_mc_resume_ns = ktime_get_ns();
+
+        atomic_set(&ayaneo_led_mc_resume_pending, 1);
 
 	/* Re-apply last color */
-        write_lock(&ayaneo_led_mc_update_lock);
-        ayaneo_led_mc_update_required++;
-        write_unlock(&ayaneo_led_mc_update_lock);
+        ayaneo_led_mc_request_refresh();
 
-        /* Allow the MCU to sync with the new state */
-        msleep(AYANEO_LED_SUSPEND_RESUME_DELAY_MS);
+        atomic64_set(&ayaneo_stats.resume_callback_ns,
+                     ktime_get_ns() - ayaneo_led_mc_resume_ns);
 
-        ayaneo_led_mc_writer_thread = kthread_run(ayaneo_led_mc_writer,
-                                                  NULL,
-                                                  "ayaneo-platform led writer");
         return 0;
 }
 
+/* The writer thread is frozen by now, see Threaded writes */
 static int ayaneo_platform_suspend(struct platform_device *pdev, pm_message_t state)
 {
-        kthread_stop(ayaneo_led_mc_writer_thread);
+        u64 start = ktime_get_ns();
 
         switch (suspend_mode)
         {
@@ -957,7 +3492,7 @@ static int ayaneo_platform_suspend(struct platform_device *pdev, pm_message_t st
 
         case AYANEO_LED_SUSPEND_MODE_KEEP:
                 // Nothing to do.
-                break;
+                goto out;
 
         case AYANEO_LED_SUSPEND_MODE_OFF:
                 ayaneo_led_mc_take_control();
@@ -968,7 +3503,90 @@ static int ayaneo_platform_suspend(struct platform_device *pdev, pm_message_t st
         }
 
         /* Allow the MCU to sync with the new state */
-        msleep(AYANEO_LED_SUSPEND_RESUME_DELAY_MS);
+        msleep(ayaneo_ec_timing.resume_ms);
+
+out:
+        atomic64_set(&ayaneo_stats.suspend_callback_ns, ktime_get_ns() - start);
+
+        return 0;
+}
+
+/* Forcing a model:
+ *  force_model skips the DMI match and drives the named model instead. As
+ *  that would poke the EC of an unknown machine, it is only honoured together
+ *  with ec_emulate, or on an AYANEO board that dmi_table does not list yet.
+ */
+static char *force_model;
+module_param(force_model, charp, 0444);
+MODULE_PARM_DESC(force_model, "Drive the named model instead of the one matched by DMI");
+
+static int ayaneo_platform_select_model(void)
+{
+        const struct dmi_system_id *match;
+        int i;
+
+        if (ec_emulate)
+                ayaneo_ec = &ayaneo_ec_emu_transport;
+
+        if (!force_model) {
+                match = dmi_first_match(dmi_table);
+                if (!match)
+                        return -ENODEV;
+
+                model = (enum ayaneo_model)match->driver_data;
+                return 0;
+        }
+
+        if (!ec_emulate && !dmi_match(DMI_BOARD_VENDOR, "AYANEO")) {
+                pr_err("force_model requires ec_emulate on non AYANEO boards\n");
+                return -ENODEV;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(AYANEO_MODEL_TEXT); i++) {
+                if (AYANEO_MODEL_TEXT[i] && sysfs_streq(force_model, AYANEO_MODEL_TEXT[i])) {
+                        model = i;
+                        pr_info("Forcing model %s with the %s EC\n",
+                                AYANEO_MODEL_TEXT[i], ayaneo_ec->name);
+                        return 0;
+                }
+        }
+
+        pr_err("Unknown model %s\n", force_model);
+
+        return -EINVAL;
+}
+
+static int ayaneo_led_mc_regmap_init(struct device *dev)
+{
+        struct regmap *map;
+
+        switch (model) {
+                case air:
+                case air_1s:
+                case air_1s_limited:
+                case air_pro:
+                case air_plus_mendo:
+                case geek:
+                case geek_1s:
+                case ayaneo_2:
+                case ayaneo_2s:
+                case kun:
+                        map = devm_regmap_init(dev, &ayaneo_ec_legacy_bus, NULL,
+                                               &ayaneo_ec_legacy_regmap_config);
+                        break;
+                case air_plus:
+                case slide:
+                        map = devm_regmap_init(dev, &ayaneo_ec_ram_bus, NULL,
+                                               &ayaneo_ec_ram_regmap_config);
+                        break;
+                default:
+                        return -ENODEV;
+                }
+
+        if (IS_ERR(map))
+                return PTR_ERR(map);
+
+        ayaneo_led_mc_regmap = map;
 
         return 0;
 }
@@ -976,41 +3594,85 @@ static int ayaneo_platform_suspend(struct platform_device *pdev, pm_message_t st
 static int ayaneo_platform_probe(struct platform_device *pdev)
 {
         struct device *dev = &pdev->dev;
-        const struct dmi_system_id *match;
         int ret;
 
-        match = dmi_first_match(dmi_table);
-        ret = PTR_ERR_OR_ZERO(match);
+        suspend_mode_register_attr();
+
+        ret = ayaneo_led_mc_regmap_init(dev);
         if (ret)
                 return ret;
 
-        model = (enum ayaneo_model)match->driver_data;
-        suspend_mode_register_attr();
-        ayaneo_led_mc_take_control();
+        ayaneo_ec_timing_defaults();
+        ayaneo_ec_timing_apply_params();
 
         ret = devm_led_classdev_multicolor_register(dev, &ayaneo_led_mc);
         if (ret)
                 return ret;
 
         ret = devm_device_add_group(ayaneo_led_mc.led_cdev.dev, &ayaneo_led_mc_group);
-        return ret;
+        if (ret)
+                return ret;
+
+        ayaneo_platform_debugfs_init();
+
+        /* Taking control of the LEDs is left to the writer, see Threaded writes */
+        ayaneo_led_mc_controlled = false;
+        ayaneo_led_mc_resume_ns = ktime_get_ns();
+        atomic_set(&ayaneo_led_mc_resume_pending, 1);
+        ayaneo_led_mc_request_refresh();
+
+        ayaneo_led_mc_writer_thread = kthread_run(ayaneo_led_mc_writer,
+                                                  NULL,
+                                                  "ayaneo-platform led writer");
+
+        if (IS_ERR(ayaneo_led_mc_writer_thread))
+        {
+                pr_err("Failed to start writer thread.\n");
+                ret = PTR_ERR(ayaneo_led_mc_writer_thread);
+                ayaneo_led_mc_writer_thread = NULL;
+                debugfs_remove_recursive(ayaneo_debugfs_dir);
+                return ret;
+        }
+
+        /* Resume does no EC access, it does not need to hold up other devices */
+        device_enable_async_suspend(dev);
+
+        return 0;
 }
 
-static void ayaneo_platform_shutdown(struct platform_device *pdev)
+static void ayaneo_led_mc_writer_stop(void)
 {
+        if (!ayaneo_led_mc_writer_thread)
+                return;
+
         kthread_stop(ayaneo_led_mc_writer_thread);
+        ayaneo_led_mc_writer_thread = NULL;
+}
+
+/* debugfs goes first: bench and calibrate drive the EC themselves, and one
+ * running after release would take the LEDs back from the firmware.
+ */
+static void ayaneo_platform_shutdown(struct platform_device *pdev)
+{
+        debugfs_remove_recursive(ayaneo_debugfs_dir);
+        ayaneo_debugfs_dir = NULL;
+        ayaneo_led_mc_writer_stop();
         ayaneo_led_mc_release_control();
 }
 
 static void ayaneo_platform_remove(struct platform_device *pdev)
 {
-        kthread_stop(ayaneo_led_mc_writer_thread);
+        debugfs_remove_recursive(ayaneo_debugfs_dir);
+        ayaneo_debugfs_dir = NULL;
+        ayaneo_led_mc_writer_stop();
         ayaneo_led_mc_release_control();
 }
 
 static struct platform_driver ayaneo_platform_driver = {
         .driver = {
                 .name = "ayaneo-platform",
+                /* Probe does no EC access, see ayaneo_platform_probe */
+                .probe_type = PROBE_PREFER_ASYNCHRONOUS,
         },
         .probe = ayaneo_platform_probe,
         .resume = ayaneo_platform_resume,
@@ -1021,24 +3683,27 @@ static struct platform_driver ayaneo_platform_driver = {
 
 static struct platform_device *ayaneo_platform_device;
 
+/* The model is matched here rather than in probe, so that loading the module
+ * still fails on unsupported machines while probe itself runs asynchronously.
+ */
 static int __init ayaneo_platform_init(void)
 {
         int ret;
-        ayaneo_platform_device = platform_create_bundle(&ayaneo_platform_driver,
-                                        ayaneo_platform_probe, NULL, 0, NULL, 0);
-        ret = PTR_ERR_OR_ZERO(ayaneo_platform_device);
+
+        ret = ayaneo_platform_select_model();
         if (ret)
                 return ret;
 
-        ayaneo_led_mc_writer_thread = kthread_run(ayaneo_led_mc_writer,
-                                                  NULL,
-                                                  "ayaneo-platform led writer");
+        ret = platform_driver_register(&ayaneo_platform_driver);
+        if (ret)
+                return ret;
 
-        if (!ayaneo_led_mc_writer_thread)
-        {
-                pr_err("Failed to start writer thread.\n");
-                platform_device_unregister(ayaneo_platform_device);
-                return -1;
+        ayaneo_platform_device = platform_device_register_simple("ayaneo-platform",
+                                        PLATFORM_DEVID_NONE, NULL, 0);
+        ret = PTR_ERR_OR_ZERO(ayaneo_platform_device);
+        if (ret) {
+                platform_driver_unregister(&ayaneo_platform_driver);
+                return ret;
         }
 
         return 0;
@@ -1046,7 +3711,7 @@ static int __init ayaneo_platform_init(void)
 
 static void __exit ayaneo_platform_exit(void)
 {
-        kthread_stop(ayaneo_led_mc_writer_thread);
+        ayaneo_led_mc_writer_stop();
         platform_device_unregister(ayaneo_platform_device);
         platform_driver_unregister(&ayaneo_platform_driver);
 }
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Checks the EC write sequence of each model against the emulated EC.
+#
+# Usage: sudo ./check.sh ayaneo-platform.ko
+#
+# For every model under golden/ the module is loaded with the emulated EC and
+# the I/O trace of three steps is compared against the checked in one:
+#
+#  probe    take-control and the first frame applied by the writer thread
+#  color    a full color update, "255 0 128" at brightness 255
+#  partial  a color update that only changes green, "255 64 128"
+#
+# A model's line in golden/budgets, "model writes delay_us", caps the EC
+# writes and MCU delay of the two color updates. Any difference, a missing
+# golden trace or a blown budget fails the run.
+#
+# With UPDATE=1 the recorded traces replace the golden ones instead, to
+# record them on a new tree or for a change that is meant to alter a write
+# sequence. The budgets are never updated automatically. MODELS restricts the
+# run to the listed models.
+
+set -e
+
+MODULE=${1:-ayaneo-platform.ko}
+GOLDEN=$(dirname "$0")/golden
+MODELS=${MODELS:-"air air_1s air_1s_limited air_plus air_plus_mendo air_pro ayaneo_2 ayaneo_2s geek geek_1s kun slide"}
+UPDATE=${UPDATE:-0}
+
+DEVICE=/sys/bus/platform/devices/ayaneo-platform
+EMU=/sys/kernel/debug/ayaneo-platform/emulator
+
+if lsmod | grep -q '^ayaneo_platform '; then
+        echo "ayaneo-platform is already loaded, unload it first" >&2
+        exit 1
+fi
+
+tmp=$(mktemp -d)
+trap 'rmmod ayaneo_platform 2>/dev/null || true; rm -rf "$tmp"' EXIT
+
+failed=0
+
+# Waits until the writer thread has stopped applying frames
+settle() {
+        last=-1
+        while [ "$last" != "$(cat "$EMU/frames")" ]; do
+                last=$(cat "$EMU/frames")
+                sleep 0.2
+        done
+}
+
+# Compares the trace recorded so far against the golden one, then clears it
+record() {
+        cat "$EMU/trace" > "$tmp/$2.trace"
+        echo > "$EMU/trace"
+
+        if [ "$UPDATE" = 1 ]; then
+                mkdir -p "$GOLDEN/$1"
+                cp "$tmp/$2.trace" "$GOLDEN/$1/$2.trace"
+        elif [ ! -f "$GOLDEN/$1/$2.trace" ]; then
+                echo "$1: no golden $2 trace, record it with UPDATE=1" >&2
+                failed=1
+        elif ! diff -u "$GOLDEN/$1/$2.trace" "$tmp/$2.trace"; then
+                echo "$1: $2 trace differs" >&2
+                failed=1
+        fi
+}
+
+for model in $MODELS; do
+        insmod "$MODULE" ec_emulate=1 force_model="$model" ec_emulate_sleep=0 \
+                ec_emulate_trace=1
+
+        # Probe is asynchronous, wait for the LED and the first frame
+        i=0
+        while [ ! -d "$DEVICE/leds" ] || [ "$(cat "$EMU/frames" 2>/dev/null)" = 0 ]; do
+                i=$(( i + 1 ))
+                if [ "$i" -gt 50 ]; then
+                        echo "$model: no frame applied after probe" >&2
+                        exit 1
+                fi
+                sleep 0.1
+        done
+        LED=$(echo "$DEVICE"/leds/*)
+
+        settle
+        record "$model" probe
+
+        echo 0 > "$EMU/frame_max_writes"
+        echo 0 > "$EMU/frame_max_delay_us"
+
+        echo 255 > "$LED/brightness"
+        echo "255 0 128" > "$LED/multi_intensity"
+        settle
+        record "$model" color
+
+        echo "255 64 128" > "$LED/multi_intensity"
+        settle
+        record "$model" partial
+
+        writes=$(cat "$EMU/frame_max_writes")
+        delay=$(cat "$EMU/frame_max_delay_us")
+        set -- $(grep -s "^$model " "$GOLDEN/budgets" || echo "$model")
+        if [ $# -eq 3 ] && { [ "$writes" -gt "$2" ] || [ "$delay" -gt "$3" ]; }; then
+                echo "$model: $writes writes and $delay us per frame, budget is $2 and $3 us" >&2
+                failed=1
+        fi
+        printf "%-16s %4d writes %6d us\n" "$model" "$writes" "$delay"
+
+        rmmod ayaneo_platform
+done
+
+exit $failed
@@ -0,0 +1,95 @@
+#!/bin/sh
+# Benchmarks the LED pipeline of each model against the emulated EC.
+#
+# Usage: sudo ./sim.sh ayaneo-platform.ko
+#
+# MODELS selects the models to run, FRAMES the number of color updates per
+# model. LATENCY_NS is the cost of each emulated EC access. With SLEEP=0 the
+# MCU delays and access latency are only accounted, so the run finishes as
+# fast as the driver logic allows and "sim ms" is the time the same frames
+# would take on hardware.
+
+set -e
+
+MODULE=${1:-ayaneo-platform.ko}
+MODELS=${MODELS:-"air air_1s air_1s_limited air_plus air_plus_mendo air_pro ayaneo_2 ayaneo_2s geek geek_1s kun slide"}
+FRAMES=${FRAMES:-1000}
+LATENCY_NS=${LATENCY_NS:-1000}
+SLEEP=${SLEEP:-0}
+
+DEVICE=/sys/bus/platform/devices/ayaneo-platform
+EMU=/sys/kernel/debug/ayaneo-platform/emulator
+
+if lsmod | grep -q '^ayaneo_platform '; then
+        echo "ayaneo-platform is already loaded, unload it first" >&2
+        exit 1
+fi
+
+trap 'rmmod ayaneo_platform 2>/dev/null || true' EXIT
+
+counter() {
+        cat "$EMU/$1"
+}
+
+printf "%-16s %8s %10s %12s %12s %10s\n" \
+        model frames "frames/s" "writes/frame" "delay us/fr" "sim ms"
+
+for model in $MODELS; do
+        insmod "$MODULE" ec_emulate=1 force_model="$model" \
+                ec_emulate_latency_ns="$LATENCY_NS" ec_emulate_sleep="$SLEEP"
+
+        # Probe is asynchronous, wait for the LED class device
+        i=0
+        while [ ! -d "$DEVICE/leds" ]; do
+                i=$(( i + 1 ))
+                if [ "$i" -gt 50 ]; then
+                        echo "$model: LED device did not appear" >&2
+                        exit 1
+                fi
+                sleep 0.1
+        done
+        LED=$(echo "$DEVICE"/leds/*)
+
+        echo 255 > "$LED/brightness"
+        # Let take-control and the first frame settle before measuring
+        sleep 1
+
+        frames0=$(counter frames)
+        writes0=$(( $(counter port_writes) + $(counter ec_writes) ))
+        delay0=$(counter delay_us)
+        busy0=$(counter busy_ns)
+        start=$(date +%s%N)
+
+        i=0
+        while [ "$i" -lt "$FRAMES" ]; do
+                echo "$(( i % 256 )) $(( (i * 7) % 256 )) $(( (i * 13) % 256 ))" \
+                        > "$LED/multi_intensity"
+                i=$(( i + 1 ))
+        done
+
+        # Wait for the writer to drain the last update
+        last=-1
+        while [ "$last" != "$(counter frames)" ]; do
+                last=$(counter frames)
+                end=$(date +%s%N)
+                sleep 0.1
+        done
+
+        frames=$(( $(counter frames) - frames0 ))
+        writes=$(( $(counter port_writes) + $(counter ec_writes) - writes0 ))
+        delay=$(( $(counter delay_us) - delay0 ))
+        busy=$(( $(counter busy_ns) - busy0 ))
+        wall_ns=$(( end - start ))
+
+        if [ "$frames" -gt 0 ]; then
+                printf "%-16s %8d %10d %12d %12d %10d\n" "$model" "$frames" \
+                        $(( frames * 1000000000 / wall_ns )) \
+                        $(( writes / frames )) \
+                        $(( delay / frames )) \
+                        $(( (delay * 1000 + busy) / 1000000 ))
+        else
+                printf "%-16s %8d\n" "$model" 0
+        fi
+
+        rmmod ayaneo_platform
+done